@@ -0,0 +1,195 @@
+#include <benchmark/benchmark.h>
+#include <array>
+#include <cstdint>
+#include <random>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <tls/cache.h>
+#include <tls/cache_stats_collected.h>
+
+// Lookups of keys that are always in the cache
+template <class Key, class Value>
+static void cache_get_or_hit(benchmark::State& state) {
+	using cache_t = tls::cache<Key, Value, Key(-1)>;
+	cache_t cache;
+	Key const num_keys = static_cast<Key>(cache_t::max_entries());
+	for (Key k = 0; k < num_keys; k++)
+		cache.get_or(k, [](Key key) { return static_cast<Value>(key); });
+
+	Key k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(k, [](Key key) { return static_cast<Value>(key); }));
+		k = (k + 1 == num_keys) ? 0 : k + 1;
+	}
+}
+BENCHMARK(cache_get_or_hit<std::int8_t, std::int8_t>);
+BENCHMARK(cache_get_or_hit<short, int>);
+BENCHMARK(cache_get_or_hit<int, int>);
+BENCHMARK(cache_get_or_hit<int, double>);
+BENCHMARK(cache_get_or_hit<std::int64_t, std::int64_t>);
+
+// Lookups that always miss, by cycling through one key more than the cache can hold
+template <class Key, class Value>
+static void cache_get_or_miss(benchmark::State& state) {
+	using cache_t = tls::cache<Key, Value, Key(-1)>;
+	cache_t cache;
+	Key const num_keys = static_cast<Key>(cache_t::max_entries() + 1);
+
+	Key k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(k, [](Key key) { return static_cast<Value>(key); }));
+		k = (k + 1 == num_keys) ? 0 : k + 1;
+	}
+}
+BENCHMARK(cache_get_or_miss<std::int8_t, std::int8_t>);
+BENCHMARK(cache_get_or_miss<short, int>);
+BENCHMARK(cache_get_or_miss<int, int>);
+BENCHMARK(cache_get_or_miss<int, double>);
+BENCHMARK(cache_get_or_miss<std::int64_t, std::int64_t>);
+
+// Lookups in caches with several sets, cycling through half as many keys as they can hold
+template <std::size_t num_sets>
+static void cache_get_or_sets(benchmark::State& state) {
+	using cache_t = tls::cache<int, int, -1, 64UL, num_sets>;
+	cache_t cache;
+	int const num_keys = static_cast<int>(cache_t::max_entries() / 2);
+
+	int k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(k, [](int key) { return key; }));
+		k = (k + 1 == num_keys) ? 0 : k + 1;
+	}
+}
+BENCHMARK(cache_get_or_sets<1>);
+BENCHMARK(cache_get_or_sets<2>);
+BENCHMARK(cache_get_or_sets<4>);
+BENCHMARK(cache_get_or_sets<8>);
+
+// Lookups of skewed keys, where a few keys are hot and the rest miss often.
+// The miss rate is reported in the 'miss_rate' counter.
+template <class Replacement>
+static void cache_replacement(benchmark::State& state) {
+	tls::cache<int, int, -1, 64UL, 1, Replacement> cache;
+
+	std::vector<int> keys(4096);
+	std::mt19937 gen(42);
+	std::geometric_distribution<int> dist(0.15);
+	for (int& k : keys)
+		k = dist(gen);
+
+	std::size_t i = 0;
+	std::int64_t misses = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(keys[i], [&misses](int key) {
+			misses++;
+			return key;
+		}));
+		i = (i + 1) % keys.size();
+	}
+	state.counters["miss_rate"] = static_cast<double>(misses) / static_cast<double>(state.iterations());
+}
+BENCHMARK(cache_replacement<tls::replacement::fifo>);
+BENCHMARK(cache_replacement<tls::replacement::round_robin>);
+BENCHMARK(cache_replacement<tls::replacement::random>);
+BENCHMARK(cache_replacement<tls::replacement::lru>);
+BENCHMARK(cache_replacement<tls::replacement::clock>);
+
+// Lookups of keys that are always in the cache, with the different stats policies
+template <class Stats>
+static void cache_get_or_stats(benchmark::State& state) {
+	using cache_t = tls::cache<int, int, -1, 64UL, 1, tls::replacement::fifo, Stats>;
+	cache_t cache;
+	int const num_keys = static_cast<int>(cache_t::max_entries());
+
+	int k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(k, [](int key) { return key; }));
+		k = (k + 1 == num_keys) ? 0 : k + 1;
+	}
+}
+BENCHMARK(cache_get_or_stats<tls::cache_stats::none>);
+BENCHMARK(cache_get_or_stats<tls::cache_stats::local>);
+BENCHMARK(cache_get_or_stats<tls::cache_stats::collected<>>);
+
+// A new threads first lookups of a hot set of keys, in a cache that starts out empty or is
+// copied from an image that was seeded at compile time
+static constexpr int slow_value(int key) {
+	int v = key;
+	for (int i = 0; i < 64; i++)
+		v = (v * 31 + i) % 1009;
+	return v;
+}
+
+template <class Replacement, bool warm>
+static void cache_thread_start(benchmark::State& state) {
+	using cache_t = tls::cache<int, int, -1, 64UL, 1, Replacement>;
+	static constexpr cache_t image = cache_t::warmed(std::views::iota(0, 8), slow_value);
+
+	for (auto _ : state) {
+		cache_t cache = warm ? image : cache_t{};
+		benchmark::DoNotOptimize(cache);
+		for (int k = 0; k < 8; k++)
+			benchmark::DoNotOptimize(cache.get_or(k, slow_value));
+	}
+}
+BENCHMARK(cache_thread_start<tls::replacement::fifo, false>);
+BENCHMARK(cache_thread_start<tls::replacement::fifo, true>);
+BENCHMARK(cache_thread_start<tls::replacement::frozen, true>);
+
+// Lookups of keys that are always in an indirect cache, which returns the values by reference
+template <class Value>
+static void indirect_cache_get_or_hit(benchmark::State& state) {
+	using cache_t = tls::indirect_cache<int, Value, -1>;
+	cache_t cache;
+	int const num_keys = static_cast<int>(cache_t::max_entries());
+	for (int k = 0; k < num_keys; k++)
+		cache.get_or(k, [](int) { return Value{}; });
+
+	int k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(&cache.get_or(k, [](int) { return Value{}; }));
+		k = (k + 1 == num_keys) ? 0 : k + 1;
+	}
+}
+BENCHMARK(indirect_cache_get_or_hit<int>);
+BENCHMARK(indirect_cache_get_or_hit<std::string>);
+BENCHMARK(indirect_cache_get_or_hit<std::array<char, 256>>);
+
+// Lookups of string keys with string_views, like interning symbols
+static std::vector<std::string> make_symbols(std::size_t count) {
+	std::vector<std::string> symbols;
+	for (std::size_t i = 0; i < count; i++)
+		symbols.push_back("symbol_name_" + std::to_string(i));
+	return symbols;
+}
+
+static void hashed_cache_get_or_hit(benchmark::State& state) {
+	using cache_t = tls::hashed_cache<std::string, int, std::hash<std::string_view>>;
+	cache_t cache;
+	std::vector<std::string> const symbols = make_symbols(cache_t::max_entries() / 2);
+
+	std::size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cache.get_or(std::string_view{symbols[i]}, [](std::string_view) { return 0; }));
+		i = (i + 1 == symbols.size()) ? 0 : i + 1;
+	}
+}
+BENCHMARK(hashed_cache_get_or_hit);
+
+// Baseline: a lookup in an unordered_map
+static void unordered_map_find(benchmark::State& state) {
+	std::vector<std::string> const symbols = make_symbols(16);
+	std::unordered_map<std::string, int> map;
+	for (std::string const& s : symbols)
+		map.emplace(s, 0);
+
+	std::size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(map.find(symbols[i]));
+		i = (i + 1 == symbols.size()) ? 0 : i + 1;
+	}
+}
+BENCHMARK(unordered_map_find);
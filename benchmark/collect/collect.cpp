@@ -0,0 +1,406 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <tls/collect.h>
+#include <tls/dynamic_collect.h>
+#include <tls/split.h>
+
+#ifdef TLS_BENCHMARK_SHARED_LIBRARY
+#include "shared_library.h"
+#endif
+
+#ifdef TLS_BENCHMARK_TBB
+#include <tbb/enumerable_thread_specific.h>
+#endif
+
+// Keeps a number of threads alive until it goes out of scope. Each thread
+// runs 'setup' once and then sleeps, so their thread-local data stays registered.
+class parked_threads {
+public:
+	parked_threads(int num_threads, std::function<void()> const& setup) {
+		for (int i = 0; i < num_threads; i++) {
+			threads.emplace_back([this, setup] {
+				setup();
+				{
+					std::scoped_lock sl(mtx);
+					num_ready++;
+				}
+				cv.notify_all();
+
+				std::unique_lock ul(mtx);
+				cv.wait(ul, [this] { return done; });
+			});
+		}
+
+		std::unique_lock ul(mtx);
+		cv.wait(ul, [this, num_threads] { return num_ready == num_threads; });
+	}
+
+	~parked_threads() {
+		{
+			std::scoped_lock sl(mtx);
+			done = true;
+		}
+		cv.notify_all();
+	}
+
+private:
+	std::mutex mtx;
+	std::condition_variable cv;
+	int num_ready = 0;
+	bool done = false;
+	std::vector<std::jthread> threads;
+};
+
+// Baseline: a plain thread_local per thread, registered in a mutex protected list
+struct mutex_registry {
+	std::mutex mtx;
+	std::vector<int*> slots;
+
+	int& local() {
+		thread_local int* slot = [this] {
+			thread_local int data = 0;
+			std::scoped_lock sl(mtx);
+			slots.push_back(&data);
+			return &data;
+		}();
+		return *slot;
+	}
+
+	int sum() {
+		std::scoped_lock sl(mtx);
+		int result = 0;
+		for (int* slot : slots)
+			result += std::exchange(*slot, 0);
+		return result;
+	}
+};
+
+//
+// local() first-touch, ie. the cost of registering a new thread
+//
+template <typename T>
+static void collect_local_first_touch(benchmark::State& state) {
+	tls::collect<T, std::vector, struct first_touch> collector;
+	for (auto _ : state) {
+		std::chrono::duration<double> elapsed{};
+		std::thread([&] {
+			auto const start = std::chrono::high_resolution_clock::now();
+			benchmark::DoNotOptimize(&collector.local());
+			elapsed = std::chrono::high_resolution_clock::now() - start;
+		}).join();
+		state.SetIterationTime(elapsed.count());
+	}
+	(void)collector.gather();
+}
+BENCHMARK(collect_local_first_touch<int>)->UseManualTime();
+BENCHMARK(collect_local_first_touch<std::vector<int>>)->UseManualTime();
+
+static void mutex_registry_local_first_touch(benchmark::State& state) {
+	for (auto _ : state) {
+		mutex_registry registry;
+		std::chrono::duration<double> elapsed{};
+		std::thread([&] {
+			auto const start = std::chrono::high_resolution_clock::now();
+			benchmark::DoNotOptimize(&registry.local());
+			elapsed = std::chrono::high_resolution_clock::now() - start;
+		}).join();
+		state.SetIterationTime(elapsed.count());
+	}
+}
+BENCHMARK(mutex_registry_local_first_touch)->UseManualTime();
+
+//
+// Short-lived threads, ie. the cost of registering and expiring a thread,
+// with the data from expired threads gathered every 64 threads
+//
+template <typename SlotPolicy>
+static void collect_thread_churn(benchmark::State& state) {
+	using collector = tls::collect<int, std::list, struct churn, 64UL, SlotPolicy>;
+	int n = 0;
+	for (auto _ : state) {
+		std::thread([] { benchmark::DoNotOptimize(++collector::local()); }).join();
+		if (++n == 64) {
+			n = 0;
+			benchmark::DoNotOptimize(collector::gather());
+		}
+	}
+	(void)collector::gather();
+}
+BENCHMARK(collect_thread_churn<tls::thread_local_slots>);
+BENCHMARK(collect_thread_churn<tls::pooled_slots>);
+
+// Short-lived threads that each need a 64 KiB scratch buffer
+template <typename Splitter>
+static void split_scratch_churn(benchmark::State& state) {
+	for (auto _ : state) {
+		std::thread([] {
+			std::vector<char>& buffer = Splitter::local();
+			buffer.clear();
+			buffer.resize(64 * 1024, 'x');
+			benchmark::DoNotOptimize(buffer.data());
+		}).join();
+	}
+}
+BENCHMARK(split_scratch_churn<tls::split<std::vector<char>, struct scratch>>);
+BENCHMARK(split_scratch_churn<tls::recycled_split<std::vector<char>, struct scratch>>);
+
+//
+// local() steady-state, ie. the cost of accessing already registered data
+//
+static void collect_local(benchmark::State& state) {
+	tls::collect<int> collector;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++collector.local());
+	}
+	if (state.thread_index() == 0)
+		(void)collector.gather();
+}
+BENCHMARK(collect_local)->ThreadRange(1, 16)->UseRealTime();
+
+static void collect_per_cpu_local(benchmark::State& state) {
+	using collector = tls::collect<int, std::vector, struct per_cpu_local, 64UL, tls::per_cpu_slots>;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++*collector::local());
+	}
+	if (state.thread_index() == 0)
+		(void)collector::gather();
+}
+BENCHMARK(collect_per_cpu_local)->ThreadRange(1, 16)->UseRealTime();
+
+static void collect_handle(benchmark::State& state) {
+	tls::collect<int> collector;
+	auto const h = collector.handle();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++*h);
+	}
+	if (state.thread_index() == 0)
+		(void)collector.gather();
+}
+BENCHMARK(collect_handle)->ThreadRange(1, 16)->UseRealTime();
+
+#ifdef TLS_BENCHMARK_SHARED_LIBRARY
+// local() called in a shared library, and a handle from the shared library used in a loop
+static void collect_local_shared_library(benchmark::State& state) {
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(collect_shared_local());
+	}
+}
+BENCHMARK(collect_local_shared_library);
+
+static void collect_handle_shared_library(benchmark::State& state) {
+	auto const h = collect_shared_handle();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++*h);
+	}
+}
+BENCHMARK(collect_handle_shared_library);
+#endif
+
+static void dynamic_collect_local(benchmark::State& state) {
+	static tls::dynamic_collect<int> collector;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++collector.local());
+	}
+}
+BENCHMARK(dynamic_collect_local)->ThreadRange(1, 16)->UseRealTime();
+
+static void thread_local_local(benchmark::State& state) {
+	for (auto _ : state) {
+		thread_local int data = 0;
+		benchmark::DoNotOptimize(++data);
+	}
+}
+BENCHMARK(thread_local_local)->ThreadRange(1, 16)->UseRealTime();
+
+static void atomic_reduction(benchmark::State& state) {
+	static std::atomic_int counter = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(counter.fetch_add(1, std::memory_order_relaxed));
+	}
+}
+BENCHMARK(atomic_reduction)->ThreadRange(1, 16)->UseRealTime();
+
+#ifdef TLS_BENCHMARK_TBB
+static void tbb_ets_local(benchmark::State& state) {
+	static tbb::enumerable_thread_specific<int> ets(0);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(++ets.local());
+	}
+}
+BENCHMARK(tbb_ets_local)->ThreadRange(1, 16)->UseRealTime();
+#endif
+
+//
+// local() while another thread repeatedly traverses the threads, with and without padding
+//
+template <std::size_t cache_line>
+static void collect_local_while_traversed(benchmark::State& state) {
+	using collector = tls::collect<int, std::vector, struct traversed, cache_line>;
+	if (state.thread_index() == 0) {
+		for (auto _ : state) {
+			int sum = 0;
+			collector::for_each([&sum](int const& i) { sum += i; });
+			benchmark::DoNotOptimize(sum);
+		}
+	} else {
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(++collector::local());
+		}
+	}
+}
+BENCHMARK(collect_local_while_traversed<64>)->ThreadRange(2, 16)->UseRealTime();
+BENCHMARK(collect_local_while_traversed<0>)->ThreadRange(2, 16)->UseRealTime();
+
+//
+// gather() with 1-256 live threads
+//
+static void collect_gather(benchmark::State& state) {
+	using collector = tls::unique_collect<int>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { collector::local() = 1; });
+
+	for (auto _ : state) {
+		auto const result = collector::gather();
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(collect_gather)->RangeMultiplier(2)->Range(1, 256);
+
+static void collect_per_cpu_gather(benchmark::State& state) {
+	using collector = tls::collect<int, std::vector, struct per_cpu_gather, 64UL, tls::per_cpu_slots>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { *collector::local() = 1; });
+
+	for (auto _ : state) {
+		auto const result = collector::gather();
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(collect_per_cpu_gather)->RangeMultiplier(2)->Range(1, 256);
+
+static void collect_gather_into(benchmark::State& state) {
+	using collector = tls::unique_collect<int>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { collector::local() = 1; });
+
+	std::vector<int> result;
+	for (auto _ : state) {
+		collector::gather_into(result);
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(collect_gather_into)->RangeMultiplier(2)->Range(1, 256);
+
+static void mutex_registry_sum(benchmark::State& state) {
+	mutex_registry registry;
+	parked_threads const threads(static_cast<int>(state.range(0)), [&registry] { registry.local() = 1; });
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(registry.sum());
+	}
+}
+BENCHMARK(mutex_registry_sum)->RangeMultiplier(2)->Range(1, 256);
+
+#ifdef TLS_BENCHMARK_TBB
+static void tbb_ets_combine(benchmark::State& state) {
+	tbb::enumerable_thread_specific<int> ets(0);
+	parked_threads const threads(static_cast<int>(state.range(0)), [&ets] { ets.local() = 1; });
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(ets.combine(std::plus<int>{}));
+	}
+}
+BENCHMARK(tbb_ets_combine)->RangeMultiplier(2)->Range(1, 256);
+#endif
+
+//
+// gather_flattened() with 1-256 live threads, each holding 1024 elements
+//
+static void collect_gather_flattened(benchmark::State& state) {
+	using collector = tls::unique_collect<std::vector<int>>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { collector::local().reserve(1024); });
+
+	std::vector<int> dest;
+	for (auto _ : state) {
+		state.PauseTiming();
+		dest.clear();
+		collector::for_each([](std::vector<int>& v) { v.resize(1024, 1); });
+		state.ResumeTiming();
+
+		collector::gather_flattened(std::back_inserter(dest));
+		benchmark::DoNotOptimize(dest.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 1024);
+}
+BENCHMARK(collect_gather_flattened)->RangeMultiplier(2)->Range(1, 256);
+
+static void collect_gather_flattened_vector(benchmark::State& state) {
+	using collector = tls::unique_collect<std::vector<int>>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { collector::local().reserve(1024); });
+
+	std::vector<int> dest;
+	for (auto _ : state) {
+		state.PauseTiming();
+		dest.clear();
+		collector::for_each([](std::vector<int>& v) { v.resize(1024, 1); });
+		state.ResumeTiming();
+
+		collector::gather_flattened(dest);
+		benchmark::DoNotOptimize(dest.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 1024);
+}
+BENCHMARK(collect_gather_flattened_vector)->RangeMultiplier(2)->Range(1, 256);
+
+//
+// Merging 16K-bucket histograms from 1-256 live threads,
+// with a tree-structured combine() and a linear fold in for_each()
+//
+using histogram = std::vector<std::uint32_t>;
+constexpr std::size_t histogram_buckets = 16 * 1024;
+
+static histogram merge_histograms(histogram&& a, histogram&& b) {
+	if (a.size() < b.size())
+		std::swap(a, b);
+	for (std::size_t i = 0; i < b.size(); i++)
+		a[i] += b[i];
+	return std::move(a);
+}
+
+static void collect_combine(benchmark::State& state) {
+	using collector = tls::unique_collect<histogram>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { (void)collector::local(); });
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		collector::for_each([](histogram& h) { h.assign(histogram_buckets, 1); });
+		state.ResumeTiming();
+
+		histogram const result = collector::combine(merge_histograms);
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(collect_combine)->RangeMultiplier(4)->Range(1, 256)->UseRealTime();
+
+static void collect_for_each_merge(benchmark::State& state) {
+	using collector = tls::unique_collect<histogram>;
+	parked_threads const threads(static_cast<int>(state.range(0)), [] { (void)collector::local(); });
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		collector::for_each([](histogram& h) { h.assign(histogram_buckets, 1); });
+		state.ResumeTiming();
+
+		histogram result;
+		collector::for_each([&result](histogram& h) { result = merge_histograms(std::move(result), std::move(h)); });
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(collect_for_each_merge)->RangeMultiplier(4)->Range(1, 256)->UseRealTime();
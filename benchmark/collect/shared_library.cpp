@@ -0,0 +1,11 @@
+// Built as a shared library, so its thread_local accesses use the TLS model
+// that code in plugins gets, instead of the one the executable gets
+#include "shared_library.h"
+
+int collect_shared_local() {
+	return ++shared_collector::local();
+}
+
+shared_collector::local_handle collect_shared_handle() {
+	return shared_collector::handle();
+}
@@ -0,0 +1,14 @@
+#ifndef TLS_BENCHMARK_SHARED_LIBRARY_H
+#define TLS_BENCHMARK_SHARED_LIBRARY_H
+
+#include <tls/collect.h>
+
+using shared_collector = tls::collect<int, std::vector, struct shared_library>;
+
+// Increments the threads data with 'local()', from inside the shared library
+int collect_shared_local();
+
+// Returns a handle to the threads data, resolved inside the shared library
+shared_collector::local_handle collect_shared_handle();
+
+#endif // !TLS_BENCHMARK_SHARED_LIBRARY_H
@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <vector>
+#include <tls/collect.h>
+#include <tls/concurrent_vector.h>
+
+//
+// Appending 1M ints concurrently and moving them into a single vector
+//
+static void concurrent_vector_fill_flatten(benchmark::State& state) {
+	std::vector<int> input(1024 * 1024);
+	std::iota(input.begin(), input.end(), 0);
+
+	tls::concurrent_vector<int> cv;
+	std::vector<int> result;
+	for (auto _ : state) {
+		result.clear();
+		std::for_each(std::execution::par, input.begin(), input.end(), [&cv](int i) {
+			cv.push_back(i);
+		});
+		cv.flatten_into(result);
+		benchmark::DoNotOptimize(result.data());
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(input.size()));
+}
+BENCHMARK(concurrent_vector_fill_flatten)->UseRealTime();
+
+// Baseline: per-thread vectors, flattened with 'gather_flattened'
+static void collect_vector_fill_flatten(benchmark::State& state) {
+	std::vector<int> input(1024 * 1024);
+	std::iota(input.begin(), input.end(), 0);
+
+	using collector = tls::collect<std::vector<int>, std::vector, struct fill_flatten>;
+	std::vector<int> result;
+	for (auto _ : state) {
+		result.clear();
+		// Start from empty vectors every time, like a new 'concurrent_vector'
+		collector::for_each([](std::vector<int>& v) { std::vector<int>().swap(v); });
+		std::for_each(std::execution::par, input.begin(), input.end(), [](int i) {
+			collector::local().push_back(i);
+		});
+		collector::gather_flattened(result);
+		benchmark::DoNotOptimize(result.data());
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(input.size()));
+}
+BENCHMARK(collect_vector_fill_flatten)->UseRealTime();
+
+//
+// Sorting the elements of a concurrent_vector, against flattening and sorting them in parallel
+//
+static void concurrent_vector_sort_into(benchmark::State& state) {
+	std::vector<int> input(1024 * 1024);
+	std::iota(input.begin(), input.end(), 0);
+	std::ranges::reverse(input);
+
+	tls::concurrent_vector<int> cv;
+	std::vector<int> result;
+	for (auto _ : state) {
+		state.PauseTiming();
+		result.clear();
+		std::for_each(std::execution::par, input.begin(), input.end(), [&cv](int i) {
+			cv.push_back(i);
+		});
+		state.ResumeTiming();
+
+		cv.sort_into(result);
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(concurrent_vector_sort_into)->UseRealTime();
+
+static void concurrent_vector_flatten_sort(benchmark::State& state) {
+	std::vector<int> input(1024 * 1024);
+	std::iota(input.begin(), input.end(), 0);
+	std::ranges::reverse(input);
+
+	tls::concurrent_vector<int> cv;
+	std::vector<int> result;
+	for (auto _ : state) {
+		state.PauseTiming();
+		result.clear();
+		std::for_each(std::execution::par, input.begin(), input.end(), [&cv](int i) {
+			cv.push_back(i);
+		});
+		state.ResumeTiming();
+
+		cv.flatten_into(result);
+		std::sort(std::execution::par, result.begin(), result.end());
+		benchmark::DoNotOptimize(result.data());
+	}
+}
+BENCHMARK(concurrent_vector_flatten_sort)->UseRealTime();
@@ -0,0 +1,35 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <tls/counter.h>
+
+static void counter_add(benchmark::State& state) {
+	using counter = tls::counter<long, struct add>;
+	for (auto _ : state) {
+		counter::add(1);
+	}
+}
+BENCHMARK(counter_add)->ThreadRange(1, 16)->UseRealTime();
+
+// Reads the counter while the other threads add to it
+static void counter_read(benchmark::State& state) {
+	using counter = tls::counter<long, struct read>;
+	if (state.thread_index() == 0) {
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(counter::read());
+		}
+	} else {
+		for (auto _ : state) {
+			counter::add(1);
+		}
+	}
+}
+BENCHMARK(counter_read)->ThreadRange(2, 16)->UseRealTime();
+
+// Baseline: a single shared atomic
+static void atomic_counter_add(benchmark::State& state) {
+	static std::atomic_long counter = 0;
+	for (auto _ : state) {
+		counter.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+BENCHMARK(atomic_counter_add)->ThreadRange(1, 16)->UseRealTime();
@@ -0,0 +1,45 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <tls/histogram.h>
+
+static void histogram_record(benchmark::State& state) {
+	using histogram = tls::histogram<5, struct record>;
+	std::uint64_t value = 1;
+	for (auto _ : state) {
+		histogram::record(value);
+		value = value * 6364136223846793005ull + 1442695040888963407ull;
+	}
+}
+BENCHMARK(histogram_record)->ThreadRange(1, 16)->UseRealTime();
+
+// Reads the histogram while the other threads record into it
+static void histogram_read(benchmark::State& state) {
+	using histogram = tls::histogram<5, struct read>;
+	if (state.thread_index() == 0) {
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(histogram::read().count());
+		}
+	} else {
+		std::uint64_t value = 1;
+		for (auto _ : state) {
+			histogram::record(value);
+			value = value * 6364136223846793005ull + 1442695040888963407ull;
+		}
+	}
+}
+BENCHMARK(histogram_read)->ThreadRange(2, 16)->UseRealTime();
+
+// Baseline: a shared histogram of atomic buckets
+static void atomic_histogram_record(benchmark::State& state) {
+	using histogram = tls::histogram<5>;
+	static std::array<std::atomic<std::uint64_t>, histogram::num_buckets> buckets{};
+	std::uint64_t value = 1;
+	for (auto _ : state) {
+		buckets[histogram::bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+		value = value * 6364136223846793005ull + 1442695040888963407ull;
+	}
+}
+BENCHMARK(atomic_histogram_record)->ThreadRange(1, 16)->UseRealTime();
@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <tls/replicate.h>
+
+// Thread 0 is the writer and writes a new value every 'range(0)' iterations,
+// the remaining threads read. A range of 0 means no writes.
+
+static void replicate_read(benchmark::State& state) {
+	static tls::replicate<int> repl{0};
+	int const write_every = static_cast<int>(state.range(0));
+
+	int i = 0;
+	int value = 0;
+	for (auto _ : state) {
+		if (state.thread_index() == 0 && write_every > 0) {
+			if (++i == write_every) {
+				i = 0;
+				repl.write(++value);
+			}
+		} else {
+			benchmark::DoNotOptimize(repl.read());
+		}
+	}
+}
+BENCHMARK(replicate_read)->ArgName("write_every")->Arg(0)->Arg(100)->Arg(10'000)->ThreadRange(2, 16)->UseRealTime();
+
+static void replicate_read_vector(benchmark::State& state) {
+	static tls::replicate<std::vector<int>> repl{std::vector<int>(1024)};
+	int const write_every = static_cast<int>(state.range(0));
+	std::vector<int> const value(1024);
+
+	int i = 0;
+	for (auto _ : state) {
+		if (state.thread_index() == 0 && write_every > 0) {
+			if (++i == write_every) {
+				i = 0;
+				repl.write(value);
+			}
+		} else {
+			repl.read([](std::vector<int> const& v) {
+				benchmark::DoNotOptimize(v.data());
+			});
+		}
+	}
+}
+BENCHMARK(replicate_read_vector)->ArgName("write_every")->Arg(0)->Arg(100)->Arg(10'000)->ThreadRange(2, 16)->UseRealTime();
+
+template <class Policy>
+static void replicate_read_snapshot(benchmark::State& state) {
+	static tls::replicate<std::vector<int>, struct read_snapshot, Policy> repl{std::vector<int>(1024)};
+	int const write_every = static_cast<int>(state.range(0));
+	std::vector<int> const value(1024);
+
+	int i = 0;
+	for (auto _ : state) {
+		if (state.thread_index() == 0 && write_every > 0) {
+			if (++i == write_every) {
+				i = 0;
+				repl.write(value);
+			}
+		} else {
+			repl.read([](std::vector<int> const& v) {
+				benchmark::DoNotOptimize(v.data());
+			});
+		}
+	}
+}
+BENCHMARK(replicate_read_snapshot<tls::shared_snapshot>)->ArgName("write_every")->Arg(0)->Arg(100)->Arg(10'000)->ThreadRange(2, 16)->UseRealTime();
+BENCHMARK(replicate_read_snapshot<tls::per_node_snapshot>)->ArgName("write_every")->Arg(0)->Arg(100)->Arg(10'000)->ThreadRange(2, 16)->UseRealTime();
+
+// Baseline: readers copy the value under a shared lock
+static void shared_mutex_read(benchmark::State& state) {
+	static std::shared_mutex mtx;
+	static int value = 0;
+	int const write_every = static_cast<int>(state.range(0));
+
+	int i = 0;
+	for (auto _ : state) {
+		if (state.thread_index() == 0 && write_every > 0) {
+			if (++i == write_every) {
+				i = 0;
+				std::unique_lock ul(mtx);
+				value += 1;
+			}
+		} else {
+			std::shared_lock sl(mtx);
+			benchmark::DoNotOptimize(value);
+		}
+	}
+}
+BENCHMARK(shared_mutex_read)->ArgName("write_every")->Arg(0)->Arg(100)->Arg(10'000)->ThreadRange(2, 16)->UseRealTime();
@@ -1,25 +1,27 @@
-#include <cstdlib> // for rand()
-#include <iostream>
-#include <vector>
-#include <algorithm>
-#include <execution>
-
-#include <tls/collect.h>
-
-// Calculate the square root of elements in a vector
-int main() {
-    std::vector<double> input(64 * 1024 /** 1024*/);
-    std::generate(std::begin(input), std::end(input), rand);
-
-    tls::collect<std::vector<double>> vec;
-    std::for_each(std::execution::par, input.begin(), input.end(), [&vec](double val) {
-        vec.local().push_back(sqrt(val));
-    });
-
-    // Combine with a lambda
-    std::vector<double> combined_vec;
-    vec.for_each([&combined_vec](std::vector<double> const& a) {
-        combined_vec.insert(combined_vec.end(), a.begin(), a.end());
-    });
-    std::cout << "Result was " << combined_vec.size() << ", expected " << input.size() << '\n';
-}
+#include <cstdlib> // for rand()
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <execution>
+#include <cmath>
+
+#include <tls/collect.h>
+
+// Calculate the square root of elements in a vector
+int main() {
+    std::vector<double> input(64 * 1024 /** 1024*/);
+    std::generate(std::begin(input), std::end(input), rand);
+
+    tls::collect<std::vector<double>> vec;
+    std::for_each(std::execution::par, input.begin(), input.end(), [&vec](double val) {
+        vec.local().push_back(sqrt(val));
+    });
+
+    // Combine with a lambda. The threads vectors are merged pairwise in parallel,
+    // and each merge steals the buffer of its left side.
+    std::vector<double> combined_vec = vec.combine([](std::vector<double>&& a, std::vector<double>&& b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return std::move(a);
+    });
+    std::cout << "Result was " << combined_vec.size() << ", expected " << input.size() << '\n';
+}
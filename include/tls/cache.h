@@ -1,68 +1,595 @@
-#ifndef TLS_CACHE
-#define TLS_CACHE
-
-#include <algorithm>
-
-namespace tls {
-// A class using a cache-line to cache data.
-template <class Key, class Value, Key empty_slot = Key{}, size_t cache_line = 64UL>
-class cache {
-	// If you trigger this assert, then either your key- or value size is too large,
-	// or you cache_line size is too small.
-	// The cache should be able to hold at least 4 key/value pairs in order to be efficient.
-	static_assert((sizeof(Key) + sizeof(Value)) <= (cache_line / 4), "key or value size too large");
-
-	static constexpr size_t num_entries = (cache_line) / (sizeof(Key) + sizeof(Value));
-
-public:
-	constexpr cache() {
-		reset();
-	}
-
-	// Returns the value if it exists in the cache,
-	// otherwise inserts 'or_fn(k)' in cache and returns it
-	template <class Fn>
-	constexpr Value get_or(Key const k, Fn or_fn) {
-		size_t index = num_entries;
-		for (size_t i = 0; i < num_entries; i++) {
-			// no break generates cmov's instead of jumps
-			if (k == keys[i])
-				index = i;
-		}
-		if (index != num_entries)
-			return values[index];
-
-		insert_val(k, or_fn(k));
-		return values[0];
-	}
-
-	// Clears the cache
-	constexpr void reset() {
-		std::fill(keys, keys + num_entries, empty_slot);
-		std::fill(values, values + num_entries, Value{});
-	}
-
-	// Returns the number of key/value pairs that can be cached
-	static constexpr size_t max_entries() {
-		return num_entries;
-	}
-
-protected:
-	constexpr void insert_val(Key const k, Value const v) {
-		// Move all pairs one step to the right
-		std::shift_right(keys, keys + num_entries, 1);
-		std::shift_right(values, values + num_entries, 1);
-
-		// Insert the new pair at the front of the cache
-		keys[0] = k;
-		values[0] = v;
-	}
-
-private:
-	Key keys[num_entries];
-	Value values[num_entries];
-};
-
-} // namespace tls
-
-#endif // !TLS_CACHE
+#ifndef TLS_CACHE
+#define TLS_CACHE
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include "detail/no_unique_address.h"
+#include "detail/simd.h"
+
+namespace tls {
+// The replacement policies of 'tls::cache', which pick the entry to evict when a set is full.
+// Each policy has a 'state' that is stored in each set, next to the keys and values,
+// and the cache holds as many entries as can fit in the line with it.
+// 'touch(i)' is called on every hit of entry 'i', and 'make_room(keys, values)'
+// returns the entry to overwrite when a key is inserted. That entry still holds the evicted key.
+namespace replacement {
+// Evicts the oldest entry, by shifting all entries one step on every insertion.
+// Hits are cheap, but insertions move the whole line. This is the default.
+struct fifo {
+	template <std::size_t ways>
+	struct state {
+		constexpr void touch(std::size_t) noexcept {}
+
+		template <class Key, class Value>
+		constexpr std::size_t make_room(Key (&keys)[ways], Value (&values)[ways]) {
+			// Move all pairs one step to the right, and the last pair to the front
+			std::rotate(keys, keys + ways - 1, keys + ways);
+			std::rotate(values, values + ways - 1, values + ways);
+			return 0;
+		}
+	};
+};
+
+// Evicts the oldest entry, like 'fifo', but overwrites it in place
+struct round_robin {
+	template <std::size_t ways>
+	struct state {
+		constexpr void touch(std::size_t) noexcept {}
+
+		template <class Key, class Value>
+		constexpr std::size_t make_room(Key (&)[ways], Value (&)[ways]) noexcept {
+			std::size_t const victim = next;
+			next = static_cast<std::uint8_t>(victim + 1 == ways ? 0 : victim + 1);
+			return victim;
+		}
+
+		std::uint8_t next = 0;
+	};
+};
+
+// Evicts a random entry
+struct random {
+	template <std::size_t ways>
+	struct state {
+		constexpr void touch(std::size_t) noexcept {}
+
+		template <class Key, class Value>
+		constexpr std::size_t make_room(Key (&)[ways], Value (&)[ways]) noexcept {
+			// xorshift32
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return static_cast<std::size_t>((std::uint64_t{seed} * ways) >> 32);
+		}
+
+		std::uint32_t seed = 0x9E3779B9u;
+	};
+};
+
+// Evicts the least recently used entry. Each entry has an age from 0 to 'ways - 1',
+// stored in a byte. Hits make the entry the youngest and age the entries that were
+// younger than it. The ages are updated 8 at a time in 64-bit words, without branches.
+struct lru {
+	template <std::size_t ways>
+	struct state {
+		static_assert(ways <= 64, "lru ages must fit in 7 bits");
+
+		static constexpr std::size_t num_words = (ways + 7) / 8;
+		static constexpr std::uint64_t low_bits = 0x0101010101010101ull;
+		static constexpr std::uint64_t high_bits = 0x8080808080808080ull;
+
+		constexpr state() noexcept {
+			// Unused bytes are set to 127, which is older than all entries, so they never age
+			for (std::size_t i = 0; i < num_words * 8; i++) {
+				std::uint64_t const age = i < ways ? i : 127;
+				words[i / 8] |= age << (8 * (i % 8));
+			}
+		}
+
+		constexpr void touch(std::size_t index) noexcept {
+			std::uint64_t const age = (words[index / 8] >> (8 * (index % 8))) & 0xFF;
+			for (std::uint64_t& w : words) {
+				// The high bit of each byte is set if its age is less than 'age'
+				std::uint64_t const younger = ~((w | high_bits) - age * low_bits) & high_bits;
+				w += younger >> 7;
+			}
+			words[index / 8] &= ~(std::uint64_t{0xFF} << (8 * (index % 8)));
+		}
+
+		template <class Key, class Value>
+		constexpr std::size_t make_room(Key (&)[ways], Value (&)[ways]) noexcept {
+			// Find the oldest entry, and make it the youngest
+			std::size_t victim = 0;
+			for (std::size_t i = 0; i < num_words; i++) {
+				std::uint64_t const diff = words[i] ^ ((ways - 1) * low_bits);
+				std::uint64_t const zero = (diff - low_bits) & ~diff & high_bits;
+				if (zero != 0) {
+					victim = i * 8 + static_cast<std::size_t>(std::countr_zero(zero)) / 8;
+					break;
+				}
+			}
+
+			touch(victim);
+			return victim;
+		}
+
+		std::uint64_t words[num_words]{};
+	};
+};
+
+// CLOCK, or second chance. Hits set a bit on the entry, and insertions sweep a hand over
+// the entries, clearing the bits, until it finds an entry without it. New entries start
+// without the bit, so they are evicted before entries that have been hit.
+struct clock {
+	template <std::size_t ways>
+	struct state {
+		static_assert(ways <= 64, "clock bits are stored in 64 bits");
+
+		constexpr void touch(std::size_t index) noexcept {
+			referenced |= std::uint64_t{1} << index;
+		}
+
+		template <class Key, class Value>
+		constexpr std::size_t make_room(Key (&)[ways], Value (&)[ways]) noexcept {
+			while (referenced & (std::uint64_t{1} << hand)) {
+				referenced &= ~(std::uint64_t{1} << hand);
+				hand = static_cast<std::uint8_t>(hand + 1 == ways ? 0 : hand + 1);
+			}
+
+			std::size_t const victim = hand;
+			hand = static_cast<std::uint8_t>(hand + 1 == ways ? 0 : hand + 1);
+			return victim;
+		}
+
+		std::uint64_t referenced = 0;
+		std::uint8_t hand = 0;
+	};
+};
+
+// Never inserts, so the cache only holds the entries it was created with, and misses return
+// 'or_fn(k)' without caching it. Use it for read-only caches of a known hot set of keys.
+// Only 'tls::cache' supports it.
+struct frozen {
+	template <std::size_t ways>
+	struct state {
+		constexpr void touch(std::size_t) noexcept {}
+	};
+};
+} // namespace replacement
+
+// The counters kept by the stats policies of 'tls::cache'
+struct cache_counters {
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::uint64_t evictions = 0;
+};
+
+// The stats policies of 'tls::cache'
+namespace cache_stats {
+// Keeps no stats. This is the default, and takes up no space.
+struct none {
+	constexpr void hit() noexcept {}
+	constexpr void miss() noexcept {}
+	constexpr void eviction() noexcept {}
+};
+
+// Keeps the counters in the cache. Read them with 'cache::stats()'.
+struct local {
+	constexpr void hit() noexcept {
+		counters.hits++;
+	}
+	constexpr void miss() noexcept {
+		counters.misses++;
+	}
+	constexpr void eviction() noexcept {
+		counters.evictions++;
+	}
+
+	cache_counters counters{};
+};
+
+// 'cache_stats::collected', which sums the counters of the caches of all threads, is in
+// 'cache_stats_collected.h', so the cache does not depend on 'tls::collect' without it.
+} // namespace cache_stats
+
+namespace detail {
+// Returns the set that 'k' belongs in
+template <std::size_t num_sets, class Key>
+constexpr std::size_t set_index(Key const& k) {
+	if constexpr (num_sets == 1) {
+		return 0;
+	} else if constexpr (std::is_integral_v<Key>) {
+		// Fibonacci hashing, so keys that only differ in the high bits are spread out as well
+		auto const hash = static_cast<std::uint64_t>(k) * 0x9E3779B97F4A7C15ull;
+		return (hash >> 32) % num_sets;
+	} else {
+		return std::hash<Key>{}(k) % num_sets;
+	}
+}
+} // namespace detail
+
+// A class using a cache-line to cache data.
+// Lookups of integral keys compare all the keys in the line at once with vector instructions.
+// Use 'num_sets' to spread the keys over several cache-lines. Each key is hashed to one
+// set, so a lookup still only probes one line.
+// 'Replacement' is one of the policies in 'tls::replacement'.
+// 'Stats' is one of the policies in 'tls::cache_stats'. Its counters are not stored in the cache-lines.
+// A cache can be filled at compile time with the seeding constructor or 'warmed', and copied
+// into a 'thread_local constinit' cache, so new threads start with a warm cache. The copy is
+// part of the threads static TLS image, so it costs a memcpy when the thread starts:
+//   static constexpr cache_t image = cache_t::warmed(std::views::iota(0, 16), fn);
+//   thread_local constinit cache_t cache = image;
+template <class Key, class Value, Key empty_slot = Key{}, size_t cache_line = 64UL, size_t num_sets = 1,
+		  class Replacement = replacement::fifo, class Stats = cache_stats::none>
+class cache {
+	// If you trigger this assert, then either your key- or value size is too large,
+	// or you cache_line size is too small.
+	// The cache should be able to hold at least 4 key/value pairs in order to be efficient.
+	static_assert((sizeof(Key) + sizeof(Value)) <= (cache_line / 4), "key or value size too large");
+	static_assert(std::has_single_bit(cache_line), "cache_line must be a power of two");
+	static_assert(num_sets > 0, "the cache needs at least one set");
+
+	// One cache-line of keys and values
+	template <size_t ways>
+	struct alignas(cache_line) set_of_size {
+		Key keys[ways];
+		Value values[ways];
+		TLS_NO_UNIQUE_ADDRESS typename Replacement::template state<ways> replacement{};
+	};
+
+	// Returns the number of entries that fit in a line along with the replacement state
+	template <size_t ways>
+	static consteval size_t fit_entries() {
+		if constexpr (ways == 1 || sizeof(set_of_size<ways>) <= cache_line)
+			return ways;
+		else
+			return fit_entries<ways - 1>();
+	}
+
+	static constexpr size_t num_entries = fit_entries<(cache_line) / (sizeof(Key) + sizeof(Value))>();
+	using set = set_of_size<num_entries>;
+
+	static constexpr bool is_frozen = std::same_as<Replacement, replacement::frozen>;
+
+	// Returns the set that 'k' belongs in
+	constexpr set& set_of(Key const k) {
+		return sets[detail::set_index<num_sets>(k)];
+	}
+
+public:
+	constexpr cache() {
+		// Empty stats take up no space, so the cache is exactly its cache-lines
+		static_assert(!std::is_empty_v<Stats> || sizeof(cache) == num_sets * cache_line, "the sets are larger than a cache-line");
+		reset();
+	}
+
+	// Creates a cache holding 'entries'. If more entries belong in a set than it can hold,
+	// the replacement policy evicts the first ones, and a frozen cache drops the last ones.
+	constexpr cache(std::initializer_list<std::pair<Key, Value>> entries) : cache() {
+		for (auto const& [k, v] : entries)
+			seed(k, v);
+	}
+
+	// Returns a cache holding 'fn(k)' for each key in 'keys', like the seeding constructor
+	template <std::ranges::input_range Keys, class Fn>
+		requires(std::convertible_to<std::ranges::range_reference_t<Keys>, Key> && std::invocable<Fn&, Key>)
+	[[nodiscard]] static constexpr cache warmed(Keys&& keys, Fn fn) {
+		cache c;
+		for (Key const k : keys)
+			c.seed(k, static_cast<Value>(fn(k)));
+		return c;
+	}
+
+	// Returns the value if it exists in the cache,
+	// otherwise inserts 'or_fn(k)' in cache and returns it
+	template <class Fn>
+	constexpr Value get_or(Key const k, Fn or_fn) {
+		set& s = set_of(k);
+
+		size_t const index = detail::find_key(s.keys, k);
+		if (index != num_entries) {
+			s.replacement.touch(index);
+			counters.hit();
+			return s.values[index];
+		}
+
+		counters.miss();
+		if constexpr (is_frozen)
+			return or_fn(k);
+		else
+			return insert_val(s, k, or_fn(k));
+	}
+
+	// Clears the cache
+	constexpr void reset() {
+		for (set& s : sets) {
+			std::fill(s.keys, s.keys + num_entries, empty_slot);
+			std::fill(s.values, s.values + num_entries, Value{});
+			s.replacement = {};
+		}
+	}
+
+	// Returns the number of key/value pairs that can be cached
+	static constexpr size_t max_entries() {
+		return num_entries * num_sets;
+	}
+
+	// Returns the counters of a cache using 'cache_stats::local'
+	constexpr cache_counters stats() const noexcept
+		requires(std::same_as<Stats, cache_stats::local>)
+	{
+		return counters.counters;
+	}
+
+	// Returns the number of key/value pairs that can be cached in each set
+	static constexpr size_t ways() {
+		return num_entries;
+	}
+
+protected:
+	constexpr Value insert_val(set& s, Key const k, Value const v) {
+		size_t const index = s.replacement.make_room(s.keys, s.values);
+		if (s.keys[index] != empty_slot)
+			counters.eviction();
+
+		s.keys[index] = k;
+		s.values[index] = v;
+		return v;
+	}
+
+private:
+	// Stores a pair without counting it. A key that is already cached gets the new value.
+	constexpr void seed(Key const k, Value const v) {
+		set& s = set_of(k);
+		if (size_t const index = detail::find_key(s.keys, k); index != num_entries) {
+			s.values[index] = v;
+			return;
+		}
+
+		if constexpr (is_frozen) {
+			if (size_t const index = detail::find_key(s.keys, empty_slot); index != num_entries) {
+				s.keys[index] = k;
+				s.values[index] = v;
+			}
+		} else {
+			size_t const index = s.replacement.make_room(s.keys, s.values);
+			s.keys[index] = k;
+			s.values[index] = v;
+		}
+	}
+
+	set sets[num_sets];
+	TLS_NO_UNIQUE_ADDRESS Stats counters{};
+};
+
+// Like 'tls::cache', but only the keys are stored in the cache-lines, and the values are
+// stored in a separate array. This allows large values and values that are not trivially
+// copyable, like strings, while a lookup still only probes the line of keys.
+// Values are moved into the cache, and returned by reference. The reference is valid
+// until the next insertion into the same set.
+// The default replacement policy is 'round_robin', which evicts in the same order as 'fifo'
+// without moving the values around.
+template <class Key, class Value, Key empty_slot = Key{}, size_t cache_line = 64UL, size_t num_sets = 1,
+		  class Replacement = replacement::round_robin, class Stats = cache_stats::none>
+	requires(std::default_initializable<Value> && std::movable<Value>)
+class indirect_cache {
+	// The cache-line should be able to hold at least 4 keys
+	static_assert(sizeof(Key) <= (cache_line / 4), "key size too large");
+	static_assert(std::has_single_bit(cache_line), "cache_line must be a power of two");
+	static_assert(num_sets > 0, "the cache needs at least one set");
+	static_assert(!std::same_as<Replacement, replacement::frozen>, "only tls::cache can be frozen");
+
+	// One cache-line of keys
+	template <size_t ways>
+	struct alignas(cache_line) line_of_size {
+		Key keys[ways];
+		TLS_NO_UNIQUE_ADDRESS typename Replacement::template state<ways> replacement{};
+	};
+
+	// Returns the number of keys that fit in a line along with the replacement state
+	template <size_t ways>
+	static consteval size_t fit_entries() {
+		if constexpr (ways == 1 || sizeof(line_of_size<ways>) <= cache_line)
+			return ways;
+		else
+			return fit_entries<ways - 1>();
+	}
+
+	static constexpr size_t num_entries = fit_entries<cache_line / sizeof(Key)>();
+	using line = line_of_size<num_entries>;
+
+public:
+	constexpr indirect_cache() {
+		reset();
+	}
+
+	// Returns the value if it exists in the cache,
+	// otherwise inserts 'or_fn(k)' in cache and returns it
+	template <class Fn>
+	constexpr Value const& get_or(Key const k, Fn or_fn) {
+		size_t const set = detail::set_index<num_sets>(k);
+		line& l = lines[set];
+
+		size_t const index = detail::find_key(l.keys, k);
+		if (index != num_entries) {
+			l.replacement.touch(index);
+			counters.hit();
+			return values[set][index];
+		}
+
+		// The value is computed before a slot is taken, so 'or_fn' can use the cache,
+		// and the cache is left as it was if it throws
+		counters.miss();
+		Value v = or_fn(k);
+		size_t const slot = l.replacement.make_room(l.keys, values[set]);
+		if (l.keys[slot] != empty_slot)
+			counters.eviction();
+
+		l.keys[slot] = k;
+		values[set][slot] = std::move(v);
+		return values[set][slot];
+	}
+
+	// Clears the cache
+	constexpr void reset() {
+		for (size_t set = 0; set < num_sets; set++) {
+			std::fill(lines[set].keys, lines[set].keys + num_entries, empty_slot);
+			lines[set].replacement = {};
+			for (Value& v : values[set])
+				v = Value{};
+		}
+	}
+
+	// Returns the number of key/value pairs that can be cached
+	static constexpr size_t max_entries() {
+		return num_entries * num_sets;
+	}
+
+	// Returns the number of key/value pairs that can be cached in each set
+	static constexpr size_t ways() {
+		return num_entries;
+	}
+
+	// Returns the counters of a cache using 'cache_stats::local'
+	constexpr cache_counters stats() const noexcept
+		requires(std::same_as<Stats, cache_stats::local>)
+	{
+		return counters.counters;
+	}
+
+private:
+	line lines[num_sets];
+	Value values[num_sets][num_entries]{};
+	TLS_NO_UNIQUE_ADDRESS Stats counters{};
+};
+
+// A cache for keys that are expensive to compare, like strings. The cache-lines hold 16-bit
+// fingerprints of the keys' hashes, and the keys and values are stored in a separate array.
+// A lookup compares all the fingerprints in the line at once, and only compares the full
+// key for the fingerprints that match, so most misses never touch the keys.
+// Lookups can be done with any type that 'Hash' and 'KeyEqual' accept, like looking up
+// 'std::string' keys with a 'std::string_view', if 'Hash' is 'std::hash<std::string_view>'.
+// Equal keys must have equal hashes, regardless of their type.
+// Like 'indirect_cache', values are returned by reference.
+template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<>, size_t cache_line = 64UL,
+		  size_t num_sets = 1, class Replacement = replacement::round_robin, class Stats = cache_stats::none>
+	requires(std::default_initializable<Key> && std::movable<Key> && std::default_initializable<Value> && std::movable<Value>)
+class hashed_cache {
+	static_assert(std::has_single_bit(cache_line), "cache_line must be a power of two");
+	static_assert(num_sets > 0, "the cache needs at least one set");
+	static_assert(!std::same_as<Replacement, replacement::frozen>, "only tls::cache can be frozen");
+
+	// A fingerprint of 0 marks an empty slot
+	using fingerprint = std::uint16_t;
+
+	// One cache-line of fingerprints
+	template <size_t ways>
+	struct alignas(cache_line) line_of_size {
+		fingerprint fingerprints[ways];
+		TLS_NO_UNIQUE_ADDRESS typename Replacement::template state<ways> replacement{};
+	};
+
+	// Returns the number of fingerprints that fit in a line along with the replacement state
+	template <size_t ways>
+	static consteval size_t fit_entries() {
+		if constexpr (ways == 1 || sizeof(line_of_size<ways>) <= cache_line)
+			return ways;
+		else
+			return fit_entries<ways - 1>();
+	}
+
+	static constexpr size_t num_entries = fit_entries<std::min<size_t>(64, cache_line / sizeof(fingerprint))>();
+	using line = line_of_size<num_entries>;
+
+	struct entry {
+		Key key{};
+		Value value{};
+	};
+
+	// Returns the set and the fingerprint of a key
+	template <class K>
+	constexpr std::pair<size_t, fingerprint> locate(K const& k) const {
+		// Mix the hash, because some hashes, like std::hash<int>, return the key as-is
+		std::uint64_t const hash = static_cast<std::uint64_t>(hasher(k)) * 0x9E3779B97F4A7C15ull;
+		return {(hash >> 32) % num_sets, static_cast<fingerprint>((hash >> 48) | 1)};
+	}
+
+public:
+	constexpr hashed_cache() = default;
+
+	// Returns the value if it exists in the cache,
+	// otherwise inserts 'or_fn(k)' in cache and returns it
+	template <class K, class Fn>
+		requires(std::invocable<Hash const&, K const&> && std::predicate<KeyEqual const&, Key const&, K const&> &&
+				 std::constructible_from<Key, K const&>)
+	constexpr Value const& get_or(K const& k, Fn or_fn) {
+		auto const [set, fp] = locate(k);
+		line& l = lines[set];
+
+		// Compare the keys of the matching fingerprints
+		for (std::uint64_t mask = detail::match_mask(l.fingerprints, fp); mask != 0; mask &= mask - 1) {
+			size_t const index = static_cast<size_t>(std::countr_zero(mask));
+			if (equal(entries[set][index].key, k)) {
+				l.replacement.touch(index);
+				counters.hit();
+				return entries[set][index].value;
+			}
+		}
+
+		// The entry is created before a slot is taken, like in 'indirect_cache'
+		counters.miss();
+		entry e{Key(k), or_fn(k)};
+		size_t const slot = l.replacement.make_room(l.fingerprints, entries[set]);
+		if (l.fingerprints[slot] != 0)
+			counters.eviction();
+
+		l.fingerprints[slot] = fp;
+		entries[set][slot] = std::move(e);
+		return entries[set][slot].value;
+	}
+
+	// Clears the cache
+	constexpr void reset() {
+		for (size_t set = 0; set < num_sets; set++) {
+			lines[set] = {};
+			for (entry& e : entries[set])
+				e = entry{};
+		}
+	}
+
+	// Returns the number of key/value pairs that can be cached
+	static constexpr size_t max_entries() {
+		return num_entries * num_sets;
+	}
+
+	// Returns the number of key/value pairs that can be cached in each set
+	static constexpr size_t ways() {
+		return num_entries;
+	}
+
+	// Returns the counters of a cache using 'cache_stats::local'
+	constexpr cache_counters stats() const noexcept
+		requires(std::same_as<Stats, cache_stats::local>)
+	{
+		return counters.counters;
+	}
+
+private:
+	line lines[num_sets]{};
+	entry entries[num_sets][num_entries]{};
+	TLS_NO_UNIQUE_ADDRESS Hash hasher{};
+	TLS_NO_UNIQUE_ADDRESS KeyEqual equal{};
+	TLS_NO_UNIQUE_ADDRESS Stats counters{};
+};
+
+} // namespace tls
+
+#endif // !TLS_CACHE
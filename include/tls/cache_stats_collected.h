@@ -0,0 +1,42 @@
+#ifndef TLS_CACHE_STATS_COLLECTED_H
+#define TLS_CACHE_STATS_COLLECTED_H
+
+#include <cstdint>
+#include "cache.h"
+#include "counter.h"
+
+namespace tls::cache_stats {
+// Adds the counters of every cache that uses this policy to a 'tls::counter', so they can be
+// read from any thread with 'total()', without blocking the threads using the caches.
+// Counts from expired threads are preserved.
+// Pass different types to 'UnusedDifferentiatorType' to count different caches separately.
+template <typename UnusedDifferentiatorType = void>
+struct collected {
+	void hit() noexcept {
+		hits::add(1);
+	}
+	void miss() noexcept {
+		misses::add(1);
+	}
+	void eviction() noexcept {
+		evictions::add(1);
+	}
+
+	// Returns the sum of the counters of all the caches using this policy
+	[[nodiscard]] static cache_counters total() noexcept {
+		return {hits::read(), misses::read(), evictions::read()};
+	}
+
+private:
+	// Member types, so each instantiation of 'collected' gets its own counters
+	struct hits_tag;
+	struct misses_tag;
+	struct evictions_tag;
+
+	using hits = counter<std::uint64_t, hits_tag>;
+	using misses = counter<std::uint64_t, misses_tag>;
+	using evictions = counter<std::uint64_t, evictions_tag>;
+};
+} // namespace tls::cache_stats
+
+#endif // !TLS_CACHE_STATS_COLLECTED_H
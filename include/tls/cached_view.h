@@ -0,0 +1,55 @@
+#ifndef TLS_CACHED_VIEW_H
+#define TLS_CACHED_VIEW_H
+
+#include <cstdint>
+#include <utility>
+#include "split.h"
+
+namespace tls {
+// Puts a thread-local 'Cache' in front of lookups into the data of a 'tls::replicate'.
+// Each thread has its own cache, which is reset on its next lookup after the replicated
+// data has been written to, so a hit only costs one extra compare of the data version.
+// 'Cache' is one of the caches in <tls/cache.h>.
+template <class Replicate, class Cache>
+class cached_view final {
+	struct slot {
+		Cache cache{};
+		std::uint64_t version = 0;
+	};
+
+public:
+	explicit cached_view(Replicate& repl) : repl(repl) {}
+
+	// Returns the cached value for 'k' if the data has not changed since it was cached,
+	// otherwise inserts 'or_fn(data, k)' in the cache and returns it, where 'data'
+	// is the threads copy of the replicated data.
+	template <class K, class Fn>
+	decltype(auto) get_or(K const& k, Fn&& or_fn) {
+		slot& s = slots.local();
+
+		// The data read on a miss is at least as new as this version, so at worst
+		// values computed from newer data are thrown away on the next lookup
+		std::uint64_t const version = repl.version();
+		if (s.version != version) {
+			s.cache.reset();
+			s.version = version;
+		}
+
+		return s.cache.get_or(k, [this, &or_fn](auto const& key) {
+			return or_fn(repl.read(), key);
+		});
+	}
+
+	// Returns the replicator
+	Replicate& replicator() const noexcept {
+		return repl;
+	}
+
+private:
+	Replicate& repl;
+	dynamic_split<slot> slots;
+};
+
+} // namespace tls
+
+#endif // !TLS_CACHED_VIEW_H
@@ -1,189 +1,959 @@
-#ifndef TLS_COLLECT_H
-#define TLS_COLLECT_H
-
-#include <mutex>
-#include <shared_mutex>
-#include <vector>
-#include <concepts>
-#include <forward_list>
-
-namespace tls {
-
-// Pass this type to the 'Container' argument of 'tls::collect' to not store
-// data from expired threads. Or use 'tls::split', which does the same thing.
-template<typename>
-class none {};
-
-// Provides a thread-local instance of the type T for each thread that
-// accesses it. Data is preserved when threads die.
-// You can collect the thread_local T's with collect::gather*,
-// which also resets the data on the threads by moving it.
-// Use `tls::unique_collect` or pass different types to 'UnusedDifferentiatorType'
-// to create different types.
-template <typename T, template<class...> typename Container = std::vector, typename UnusedDifferentiatorType = void>
-class collect final {
-	// This struct manages the instances that access the thread-local data.
-	// Its lifetime is marked as thread_local, which means that it can live longer than
-	// the collect<> instance that spawned it.
-	struct thread_data final {
-		thread_data() {
-			collect::init_thread(this);
-		}
-
-		~thread_data() {
-			collect::remove_thread(this);
-		}
-
-		// Return a reference to an instances local data
-		[[nodiscard]] T& get() noexcept {
-			return data;
-		}
-
-		void remove() noexcept {
-			data = {};
-			next = nullptr;
-		}
-
-		[[nodiscard]] T* get_data() noexcept {
-			return &data;
-		}
-		[[nodiscard]] T const* get_data() const noexcept {
-			return &data;
-		}
-
-		void set_next(thread_data* ia) noexcept {
-			next = ia;
-		}
-		[[nodiscard]] thread_data* get_next() noexcept {
-			return next;
-		}
-		[[nodiscard]] thread_data const* get_next() const noexcept {
-			return next;
-		}
-
-	private:
-		T data{};
-		thread_data* next = nullptr;
-	};
-
-private:
-	static constexpr bool has_container = not std::same_as<Container<T>, none<T>>;
-
-	// the head of the threads
-	inline static std::forward_list<thread_data*> head{};
-
-	// Mutex for serializing access for adding/removing thread-local instances
-	inline static std::shared_mutex mtx;
-
-	// Adds a new thread
-	static void init_thread(thread_data* t) {
-		std::unique_lock sl(mtx);
-		head.push_front(t);
-	}
-
-	// Removes the thread
-	static void remove_thread(thread_data* t) {
-		std::unique_lock sl(mtx);
-
-		if constexpr (has_container) {
-			// Take the thread data
-			T* local_data = t->get_data();
-			collected_data().push_back(static_cast<T&&>(*local_data));
-		}
-
-		// Remove the thread from the linked list
-		head.remove(t);
-	}
-
-	// Returns all the data collected from threads
-	static Container<T>& collected_data()
-		requires(has_container)
-	{
-		static Container<T> data{};
-		return data;
-	}
-
-public:
-	// Get the thread-local variable
-	[[nodiscard]] static T& local() noexcept {
-		thread_local thread_data var{};
-		return var.get();
-	}
-
-	// Gathers all the threads data and returns it. This clears all stored data.
-	[[nodiscard]]
-	static Container<T> gather()
-		requires(has_container)
-	{
-		std::unique_lock sl(mtx);
-
-		auto& data = collected_data();
-		for (thread_data* thread : head) {
-			data.push_back(std::move(*thread->get_data()));
-			*thread->get_data() = T{};
-		}
-
-		return std::move(data);
-	}
-
-	// Gathers all the threads data and sends it to the output iterator. This clears all stored data.
-	static void gather_flattened(auto dest_iterator)
-		requires(std::ranges::range<T> && has_container)
-	{
-		std::unique_lock sl(mtx);
-
-		for (T& per_thread_data : collected_data()) {
-			std::move(per_thread_data.begin(), per_thread_data.end(), dest_iterator);
-		}
-		collected_data().clear();
-
-		for (thread_data* thread : head) {
-			T* ptr_per_thread_data = thread->get_data();
-			std::move(ptr_per_thread_data->begin(), ptr_per_thread_data->end(), dest_iterator);
-			//*ptr_per_thread_data = T{};
-			ptr_per_thread_data->clear();
-		}
-	}
-
-	// Perform an action on all threads data
-	template <class Fn>
-	static void for_each(Fn&& fn) {
-		if constexpr (std::invocable<Fn, T const&>) {
-			std::shared_lock sl(mtx);
-			for (thread_data const* thread : head) {
-				fn(*thread->get_data());
-			}
-
-			if constexpr (has_container)
-				for (auto const& d : collected_data())
-					fn(d);
-		} else {
-			std::unique_lock sl(mtx);
-			for (thread_data* thread : head) {
-				fn(*thread->get_data());
-			}
-
-			if constexpr (has_container)
-				for (auto& d : collected_data())
-					fn(d);
-		}
-	}
-
-	// Clears all data
-	static void clear() {
-		std::unique_lock sl(mtx);
-		for (thread_data* thread : head) {
-			*(thread->get_data()) = {};
-		}
-
-		if constexpr (has_container)
-			collected_data().clear();
-	}
-};
-
-template <typename T, template<class...> typename Container = std::vector, auto U = [] {}>
-using unique_collect = collect<T, Container, decltype(U)>;
-
-} // namespace tls
-
-#endif // !TLS_COLLECT_H
+#ifndef TLS_COLLECT_H
+#define TLS_COLLECT_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <execution>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <concepts>
+#include <ranges>
+#include "detail/cpu.h"
+#include "detail/shared_mutex.h"
+#include "detail/tls_model.h"
+
+namespace tls {
+namespace detail {
+// Tracks traversals of a lock-free list, so a thread that unlinks a node
+// can wait for any traversal that might still see the node to finish
+// before the node's memory is released.
+class reader_epoch {
+public:
+	// Scope guard for a traversal
+	class guard {
+	public:
+		explicit guard(reader_epoch& re) noexcept : re(re), epoch(re.enter()) {}
+		~guard() {
+			re.leave(epoch);
+		}
+		guard(guard const&) = delete;
+		guard& operator=(guard const&) = delete;
+
+	private:
+		reader_epoch& re;
+		unsigned epoch;
+	};
+
+	// Waits for all traversals started before this call to finish.
+	// Calls to this function must be serialized.
+	void synchronize() noexcept {
+		// New traversals are counted in the other slot after this
+		unsigned const e = epoch.fetch_add(1);
+		while (readers[e & 1].load() != 0)
+			std::this_thread::yield();
+	}
+
+private:
+	unsigned enter() noexcept {
+		unsigned e = epoch.load();
+		while (true) {
+			readers[e & 1].fetch_add(1);
+
+			// If the epoch changed in the meantime a synchronize might have
+			// missed this traversal, so retry in the new epoch
+			unsigned const current = epoch.load();
+			if (current == e)
+				return e;
+
+			readers[e & 1].fetch_sub(1);
+			e = current;
+		}
+	}
+
+	void leave(unsigned e) noexcept {
+		readers[e & 1].fetch_sub(1);
+	}
+
+	std::atomic<unsigned> epoch{0};
+	std::atomic<std::size_t> readers[2]{};
+};
+
+// Arrays whose elements can each be read with a lock-free atomic load
+template <typename T>
+constexpr bool is_atomic_array = false;
+template <typename E, std::size_t N>
+constexpr bool is_atomic_array<std::array<E, N>> =
+	std::is_trivially_copyable_v<E> && std::atomic_ref<E>::is_always_lock_free && alignof(E) >= std::atomic_ref<E>::required_alignment;
+
+// A lock-free stack of nodes, linked through 'Node::next_free'. Popping takes the whole
+// stack with an exchange and pushes the rest back, so two threads can never pop the same
+// node, which avoids the ABA problem of popping with a compare-and-swap.
+template <typename Node>
+class node_pool {
+public:
+	// Pushes the nodes from 'first' to 'last', which are linked through 'next_free'
+	void push(Node* first, Node* last) noexcept {
+		Node* top = head.load(std::memory_order_relaxed);
+		do {
+			last->next_free = top;
+		} while (!head.compare_exchange_weak(top, first, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	void push(Node* node) noexcept {
+		push(node, node);
+	}
+
+	// Returns a node, or nullptr if the pool is empty
+	[[nodiscard]] Node* pop() noexcept {
+		Node* const top = head.exchange(nullptr, std::memory_order_acquire);
+		if (top == nullptr)
+			return nullptr;
+
+		if (Node* const rest = top->next_free; rest != nullptr) {
+			Node* last = rest;
+			while (last->next_free != nullptr)
+				last = last->next_free;
+			push(rest, last);
+		}
+
+		top->next_free = nullptr;
+		return top;
+	}
+
+private:
+	std::atomic<Node*> head{nullptr};
+};
+} // namespace detail
+
+// Pass this type to the 'SlotPolicy' argument of 'tls::collect' to store each threads data
+// in a thread_local variable. Expired threads move their data to the collected data.
+// This is the default.
+struct thread_local_slots {};
+
+// Pass this type to the 'SlotPolicy' argument of 'tls::collect' to store each threads data
+// in a slot from a pool. Expired threads only mark their slot as retired, which does not lock
+// or allocate, and the data stays in place until it is gathered. Gathers return the retired
+// slots to the pool, where new threads take their slots from.
+// Accessing the data through the slot costs an extra indirection.
+struct pooled_slots {};
+
+// Pass this type to the 'SlotPolicy' argument of 'tls::collect' to recycle the slots of
+// expired threads. A new thread adopts the slot of an expired thread with its data as it was left,
+// so things like reserved buffers keep their capacity across threads. Meant for 'tls::split',
+// where the data of expired threads is discarded anyway; with a container the data is still
+// moved to the collected data, and the slot is reset before it is adopted.
+// Accessing the data through the slot costs an extra indirection.
+struct recycled_slots {};
+
+// Pass this type to the 'SlotPolicy' argument of 'tls::collect' to have one slot per cpu instead
+// of one per thread, so memory use and the cost of gathers scale with the number of cpus instead
+// of the number of threads that ever touched the collector. Each slot is created by the first
+// thread to use it on its cpu, so its memory is first touched on that cpus NUMA node.
+// Threads can share a slot and move between cpus at any time, so 'local()' returns a lock on
+// the current cpus slot instead of a reference, which should be held only briefly.
+// Nested calls to 'local()' return the slot the thread already holds, even if it has moved to
+// another cpu, and traversals from that thread skip locking it, so a thread never waits on itself.
+// Functions passed to traversals, like 'for_each', must not call 'local()'.
+// Traversals lock each slot while they run, including the snapshot functions.
+struct per_cpu_slots {};
+
+// Pass this type to the 'Container' argument of 'tls::collect' to not store
+// data from expired threads. Or use 'tls::split', which does the same thing.
+template<typename>
+class none {};
+
+// Provides a thread-local instance of the type T for each thread that
+// accesses it. Data is preserved when threads die.
+// You can collect the thread_local T's with collect::gather*,
+// which also resets the data on the threads by moving it.
+// Use `tls::unique_collect` or pass different types to 'UnusedDifferentiatorType'
+// to create different types.
+// Each threads data is aligned and padded to 'cache_line' to prevent false sharing,
+// which is usually the value of 'std::hardware_destructive_interference_size'.
+// Pass 0 to 'cache_line' to disable the padding.
+// 'SlotPolicy' is 'thread_local_slots', 'pooled_slots', 'recycled_slots' or 'per_cpu_slots'.
+template <typename T, template<class...> typename Container = std::vector, typename UnusedDifferentiatorType = void, std::size_t cache_line = 64UL,
+		  typename SlotPolicy = thread_local_slots>
+class collect final {
+	static constexpr std::size_t data_alignment = std::max(cache_line, alignof(T));
+	static constexpr bool is_pooled = std::same_as<SlotPolicy, pooled_slots>;
+	static constexpr bool is_recycled = std::same_as<SlotPolicy, recycled_slots>;
+	static constexpr bool is_per_cpu = std::same_as<SlotPolicy, per_cpu_slots>;
+
+	// The data of one thread, linked into the list of threads
+	struct alignas(data_alignment) thread_data final {
+		// Return a reference to an instances local data
+		[[nodiscard]] T& get() noexcept {
+			return data;
+		}
+
+		[[nodiscard]] T* get_data() noexcept {
+			return &data;
+		}
+		[[nodiscard]] T const* get_data() const noexcept {
+			return &data;
+		}
+
+		void set_next(thread_data* ia) noexcept {
+			next.store(ia, std::memory_order_release);
+		}
+		[[nodiscard]] thread_data* get_next() noexcept {
+			return next.load(std::memory_order_acquire);
+		}
+		[[nodiscard]] thread_data const* get_next() const noexcept {
+			return next.load(std::memory_order_acquire);
+		}
+
+		// Set when the thread owning a pooled slot has exited
+		std::atomic_bool retired = false;
+
+		// Links the slots in the pool
+		thread_data* next_free = nullptr;
+
+		// Set while a per-cpu slot is in use
+		std::atomic_bool busy = false;
+
+		void lock() noexcept {
+			while (busy.exchange(true, std::memory_order_acquire)) {
+				while (busy.load(std::memory_order_relaxed))
+					std::this_thread::yield();
+			}
+		}
+		void unlock() noexcept {
+			busy.store(false, std::memory_order_release);
+		}
+
+	private:
+		// 'next' is read when the list of threads is traversed, so keep it
+		// off the cache line the owning thread writes to
+		std::atomic<thread_data*> next = nullptr;
+		alignas(data_alignment) T data{};
+	};
+
+	// Holds the threads data. Its lifetime is marked as thread_local, which means
+	// that it can live longer than the collect<> instance that spawned it.
+	struct thread_local_slot final {
+		thread_local_slot() {
+			collect::init_thread(&slot);
+		}
+
+		~thread_local_slot() {
+			collect::remove_thread(&slot);
+		}
+
+		[[nodiscard]] T& get() noexcept {
+			return slot.get();
+		}
+
+		thread_data slot;
+	};
+
+	// Holds the threads slot from the pool
+	struct pooled_slot final {
+		pooled_slot() : slot(collect::acquire_slot()) {}
+
+		~pooled_slot() {
+			slot->retired.store(true, std::memory_order_release);
+		}
+
+		[[nodiscard]] T& get() noexcept {
+			return slot->get();
+		}
+
+		thread_data* slot;
+	};
+
+	// Holds the threads slot, which is returned to the pool with its data when the thread exits
+	struct recycled_slot final {
+		recycled_slot() : slot(collect::acquire_slot()) {}
+
+		~recycled_slot() {
+			collect::remove_thread(slot);
+
+			// The data was moved to the collected data, so the next thread must not gather it again
+			if constexpr (has_container)
+				*slot->get_data() = T{};
+			pool.push(slot);
+		}
+
+		[[nodiscard]] T& get() noexcept {
+			return slot->get();
+		}
+
+		thread_data* slot;
+	};
+
+	// The slots of the cpus, when using 'per_cpu_slots'
+	struct cpu_slot_table final {
+		std::size_t count = std::max(1u, std::thread::hardware_concurrency());
+		std::unique_ptr<std::atomic<thread_data*>[]> slots = std::make_unique<std::atomic<thread_data*>[]>(count);
+	};
+
+	// Locks all the per-cpu slots for the duration of a traversal. Does nothing for the other policies.
+	// 'cpu_slots_mtx' is always locked before the slots, and the slot held by the calling thread
+	// is already locked.
+	class cpu_slots_lock final {
+	public:
+		cpu_slots_lock() noexcept {
+			if constexpr (is_per_cpu) {
+				cpu_slots_mtx.lock();
+				for (thread_data* slot = head.load(); slot != nullptr; slot = slot->get_next())
+					if (slot != held_cpu_slot)
+						slot->lock();
+			}
+		}
+
+		~cpu_slots_lock() {
+			if constexpr (is_per_cpu) {
+				for (thread_data* slot = head.load(); slot != nullptr; slot = slot->get_next())
+					if (slot != held_cpu_slot)
+						slot->unlock();
+				cpu_slots_mtx.unlock();
+			}
+		}
+
+		cpu_slots_lock(cpu_slots_lock const&) = delete;
+		cpu_slots_lock& operator=(cpu_slots_lock const&) = delete;
+	};
+
+	using local_slot = std::conditional_t<is_pooled, pooled_slot, std::conditional_t<is_recycled, recycled_slot, thread_local_slot>>;
+
+private:
+	static constexpr bool has_container = not std::same_as<Container<T>, none<T>>;
+
+	// The number of elements moved per task in 'gather_flattened(std::vector&)'
+	static constexpr std::size_t flatten_block_size = 64 * 1024;
+
+	// The head of the threads. Threads are linked through 'thread_data::next'
+	inline static std::atomic<thread_data*> head{};
+
+	// Mutex for serializing access to the threads data and the collected data
+	inline static detail::shared_mutex mtx{"tls::collect"};
+
+	// Keeps functions that modify the threads data from running while snapshots read it.
+	// Exiting threads don't lock it, so snapshots don't block them. It is locked before 'mtx'.
+	inline static detail::shared_mutex snapshot_mtx{"tls::collect snapshots"};
+
+	// Mutex for serializing the removal of threads from the list
+	inline static std::mutex remove_mtx;
+
+	// Tracks traversals of the thread list
+	inline static detail::reader_epoch readers;
+
+	// Serializes the creation of per-cpu slots with traversals. It is never locked while
+	// holding the lock of a slot.
+	inline static std::mutex cpu_slots_mtx;
+
+	// The per-cpu slot locked by the calling thread, if any
+	TLS_TLS_MODEL inline static constinit thread_local thread_data* held_cpu_slot = nullptr;
+
+	// The unused slots, when using 'pooled_slots' or 'recycled_slots'
+	inline static detail::node_pool<thread_data> pool;
+
+	// Adds a new thread. This is lock-free and does not allocate.
+	static void init_thread(thread_data* t) {
+		thread_data* first = head.load(std::memory_order_relaxed);
+		do {
+			t->set_next(first);
+		} while (!head.compare_exchange_weak(first, t, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Removes a thread from the linked list, and returns its predecessor, or nullptr if it was the head.
+	// 'prev' can be passed if the predecessor is known. Must be called with 'remove_mtx' locked.
+	static thread_data* unlink(thread_data* t, thread_data* prev = nullptr) {
+		if (prev == nullptr) {
+			// New threads are only added at the head, so if 't' is not the head,
+			// its predecessor can be found without racing them.
+			thread_data* first = t;
+			if (head.compare_exchange_strong(first, t->get_next()))
+				return nullptr;
+
+			prev = first;
+			while (prev->get_next() != t)
+				prev = prev->get_next();
+		}
+
+		prev->set_next(t->get_next());
+		return prev;
+	}
+
+	// Removes the thread
+	static void remove_thread(thread_data* t) {
+		{
+			std::scoped_lock sl(remove_mtx);
+			unlink(t);
+
+			// Wait for any traversals that can still see 't'
+			readers.synchronize();
+		}
+
+		if constexpr (has_container) {
+			// Take the thread data
+			std::unique_lock sl(mtx);
+			T* local_data = t->get_data();
+			collected_data().push_back(static_cast<T&&>(*local_data));
+		}
+	}
+
+	// Takes a slot from the pool, or allocates a new one, and adds it to the threads
+	static thread_data* acquire_slot() {
+		thread_data* t = pool.pop();
+		if (t == nullptr)
+			t = new thread_data{};
+		init_thread(t);
+		return t;
+	}
+
+	static cpu_slot_table& cpu_slots() {
+		static cpu_slot_table table{};
+		return table;
+	}
+
+	// Returns the slot of the cpu the calling thread is running on, and creates it if needed
+	static thread_data* current_cpu_slot() {
+		cpu_slot_table& table = cpu_slots();
+		std::atomic<thread_data*>& entry = table.slots[detail::current_cpu() % table.count];
+
+		thread_data* slot = entry.load(std::memory_order_acquire);
+		if (slot == nullptr) [[unlikely]] {
+			std::scoped_lock sl(cpu_slots_mtx);
+			slot = entry.load(std::memory_order_relaxed);
+			if (slot == nullptr) {
+				slot = new thread_data{};
+				init_thread(slot);
+				entry.store(slot, std::memory_order_release);
+			}
+		}
+		return slot;
+	}
+
+	// Moves the data of expired threads to the collected data, and their slots back to the pool.
+	// Slots that expire after this are still in the list, so they are gathered with the live threads.
+	// Must be called before 'mtx' is locked, because it waits for traversals that may be waiting
+	// for 'mtx', and before the threads are traversed.
+	static void reclaim_slots() {
+		if constexpr (is_pooled) {
+			thread_data* first = nullptr;
+			thread_data* last = nullptr;
+			{
+				std::scoped_lock sl(remove_mtx);
+				thread_data* prev = nullptr;
+				for (thread_data* thread = head.load(); thread != nullptr;) {
+					thread_data* const next = thread->get_next();
+					if (thread->retired.load(std::memory_order_acquire)) {
+						prev = unlink(thread, prev);
+						thread->next_free = first;
+						first = thread;
+						if (last == nullptr)
+							last = thread;
+					} else {
+						prev = thread;
+					}
+					thread = next;
+				}
+
+				if (first == nullptr)
+					return;
+
+				// Wait for any traversals that can still see the slots
+				readers.synchronize();
+			}
+
+			if constexpr (has_container) {
+				std::unique_lock sl(mtx);
+				for (thread_data* t = first; t != nullptr; t = t->next_free)
+					collected_data().push_back(std::move(*t->get_data()));
+			}
+
+			for (thread_data* t = first; t != nullptr; t = t->next_free) {
+				t->retired.store(false, std::memory_order_relaxed);
+				*t->get_data() = T{};
+			}
+			pool.push(first, last);
+		}
+	}
+
+	// Reads thread data that other threads may be writing to
+	static T load_relaxed(T const& t) noexcept
+		requires(std::is_trivially_copyable_v<T>)
+	{
+		if constexpr (std::atomic_ref<T>::is_always_lock_free && data_alignment >= std::atomic_ref<T>::required_alignment) {
+			return std::atomic_ref<T>(const_cast<T&>(t)).load(std::memory_order_relaxed);
+		} else if constexpr (detail::is_atomic_array<T>) {
+			// Read the elements one at a time, so each element is read atomically
+			using E = typename T::value_type;
+			T copy;
+			for (std::size_t i = 0; i < copy.size(); i++)
+				copy[i] = std::atomic_ref<E>(const_cast<E&>(t[i])).load(std::memory_order_relaxed);
+			return copy;
+		} else {
+			static_assert(std::atomic_ref<T>::is_always_lock_free && data_alignment >= std::atomic_ref<T>::required_alignment,
+				"snapshots read the data with atomic loads, so it must be lock-free as an atomic, or be a std::array of such types");
+			return t;
+		}
+	}
+
+	// Returns all the data collected from threads
+	static Container<T>& collected_data()
+		requires(has_container)
+	{
+		static Container<T> data{};
+		return data;
+	}
+
+	// Creates the threads slot on its first call
+	[[nodiscard]] static T* init_local() noexcept {
+		TLS_TLS_MODEL thread_local local_slot var{};
+		return &var.get();
+	}
+
+	// The threads data. A constant initialized pointer needs no guard variable,
+	// so finding the data is a single thread-local load and a null check.
+	TLS_TLS_MODEL inline static constinit thread_local T* cached_local = nullptr;
+
+public:
+	// A threads resolved pointer to its data, for use in tight loops.
+	// It is only valid on the thread that created it, and only while that thread is alive.
+	class local_handle final {
+	public:
+		explicit local_handle(T& data) noexcept : data(&data) {}
+
+		[[nodiscard]] T& operator*() const noexcept {
+			return *data;
+		}
+		[[nodiscard]] T* operator->() const noexcept {
+			return data;
+		}
+		[[nodiscard]] T& get() const noexcept {
+			return *data;
+		}
+
+	private:
+		T* data;
+	};
+
+	// A lock on the slot of a cpu, which is returned by 'local()' when using 'per_cpu_slots'.
+	// A nested lock on the slot the thread already holds does not lock it again.
+	class cpu_local final {
+	public:
+		explicit cpu_local(thread_data* slot) noexcept : slot(slot), nested(slot == held_cpu_slot) {
+			if (!nested) {
+				slot->lock();
+				held_cpu_slot = slot;
+			}
+		}
+		~cpu_local() {
+			if (!nested) {
+				held_cpu_slot = nullptr;
+				slot->unlock();
+			}
+		}
+		cpu_local(cpu_local const&) = delete;
+		cpu_local& operator=(cpu_local const&) = delete;
+
+		[[nodiscard]] T& operator*() const noexcept {
+			return slot->get();
+		}
+		[[nodiscard]] T* operator->() const noexcept {
+			return slot->get_data();
+		}
+
+	private:
+		thread_data* slot;
+		bool nested;
+	};
+
+	// Get the thread-local variable
+	[[nodiscard]] static T& local() noexcept
+		requires(!is_per_cpu)
+	{
+		T* data = cached_local;
+		if (data == nullptr) [[unlikely]] {
+			data = init_local();
+			cached_local = data;
+		}
+		return *data;
+	}
+
+	// Get a lock on the data of the cpu the calling thread is running on,
+	// or on the slot it already holds
+	[[nodiscard]] static cpu_local local()
+		requires(is_per_cpu)
+	{
+		if (held_cpu_slot != nullptr)
+			return cpu_local{held_cpu_slot};
+		return cpu_local{current_cpu_slot()};
+	}
+
+	// Get a handle to the thread-local variable, which skips the thread-local lookup
+	// of 'local()' on every access
+	[[nodiscard]] static local_handle handle() noexcept
+		requires(!is_per_cpu)
+	{
+		return local_handle{local()};
+	}
+
+	// Gathers all the threads data and returns it. This clears all stored data.
+	[[nodiscard]]
+	static Container<T> gather()
+		requires(has_container)
+	{
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+
+		auto& data = collected_data();
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				data.push_back(std::move(*thread->get_data()));
+				*thread->get_data() = T{};
+			}
+		}
+
+		return std::move(data);
+	}
+
+	// Gathers all the threads data into 'out', replacing its contents. The capacity of 'out'
+	// and of the internal storage for expired threads is reused, so repeated gathers into
+	// the same container do not allocate once it has grown. This clears all stored data.
+	static void gather_into(Container<T>& out)
+		requires(has_container)
+	{
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+
+		out.clear();
+		for (T& d : collected_data())
+			out.push_back(std::move(d));
+		collected_data().clear();
+
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				out.push_back(std::move(*thread->get_data()));
+				*thread->get_data() = T{};
+			}
+		}
+	}
+
+	// Gathers all the threads data into 'buffers' by swapping each threads data with one of
+	// the elements already in 'buffers', which is cleared first. The threads then keep
+	// writing into the spare buffers capacity instead of starting over from an empty T.
+	// Extra elements in 'buffers' are erased, and data from expired threads is moved to the end.
+	// This clears all stored data.
+	static void swap_local(Container<T>& buffers)
+		requires(has_container && requires(T & t) { t.clear(); })
+	{
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+
+		using std::swap;
+		auto spare = buffers.begin();
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				if (spare != buffers.end()) {
+					spare->clear();
+					swap(*spare, *thread->get_data());
+					++spare;
+				} else {
+					buffers.push_back(std::move(*thread->get_data()));
+					*thread->get_data() = T{};
+					spare = buffers.end();
+				}
+			}
+		}
+		buffers.erase(spare, buffers.end());
+
+		for (T& d : collected_data())
+			buffers.push_back(std::move(d));
+		collected_data().clear();
+	}
+
+	// Gathers all the threads data and sends it to the output iterator. This clears all stored data.
+	static void gather_flattened(auto dest_iterator)
+		requires(std::ranges::range<T> && has_container)
+	{
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+
+		for (T& per_thread_data : collected_data()) {
+			dest_iterator = std::move(per_thread_data.begin(), per_thread_data.end(), dest_iterator);
+		}
+		collected_data().clear();
+
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				T* ptr_per_thread_data = thread->get_data();
+				dest_iterator = std::move(ptr_per_thread_data->begin(), ptr_per_thread_data->end(), dest_iterator);
+				//*ptr_per_thread_data = T{};
+				ptr_per_thread_data->clear();
+			}
+		}
+	}
+
+	// Gathers all the threads data and appends it to 'dest'. 'dest' is resized once to fit
+	// all the data, which is then moved into place concurrently. This clears all stored data.
+	template <typename E, typename Alloc>
+	static void gather_flattened(std::vector<E, Alloc>& dest)
+		requires(std::ranges::sized_range<T> && has_container && std::default_initializable<E>)
+	{
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+		detail::reader_epoch::guard const g(readers);
+		cpu_slots_lock const cpu_lock;
+
+		// Find the ranges to move and their offsets in 'dest'. Large ranges are split up,
+		// so the work is spread out even if a few threads hold most of the data.
+		struct chunk {
+			T* source;
+			std::size_t first;
+			std::size_t count;
+			std::size_t offset;
+		};
+		std::vector<chunk> chunks;
+		std::size_t total = dest.size();
+		auto const add_chunks = [&](T& source) {
+			std::size_t const size = std::ranges::size(source);
+			std::size_t const block = std::ranges::random_access_range<T> ? flatten_block_size : size;
+			for (std::size_t first = 0; first < size; first += block) {
+				std::size_t const count = std::min(block, size - first);
+				chunks.push_back({&source, first, count, total});
+				total += count;
+			}
+		};
+		for (T& per_thread_data : collected_data())
+			add_chunks(per_thread_data);
+		for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next())
+			add_chunks(*thread->get_data());
+
+		dest.resize(total);
+		std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&dest](chunk const& c) {
+			E* const out = dest.data() + c.offset;
+			if constexpr (std::ranges::contiguous_range<T> && std::same_as<std::ranges::range_value_t<T>, E> && std::is_trivially_copyable_v<E>) {
+				std::memcpy(out, std::ranges::data(*c.source) + c.first, c.count * sizeof(E));
+			} else {
+				auto const first = std::next(std::ranges::begin(*c.source), static_cast<std::ptrdiff_t>(c.first));
+				std::move(first, std::next(first, static_cast<std::ptrdiff_t>(c.count)), out);
+			}
+		});
+
+		collected_data().clear();
+		for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next())
+			thread->get_data()->clear();
+	}
+
+	// Folds all the threads data and the data from expired threads into 'init'
+	// using 'op(init, data)', and returns the result. The data is not modified.
+	template <typename U, typename BinaryOp>
+	[[nodiscard]] static U reduce(U init, BinaryOp&& op) {
+		std::shared_lock sl(mtx);
+		detail::reader_epoch::guard const g(readers);
+		cpu_slots_lock const cpu_lock;
+		for (thread_data const* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+			init = op(std::move(init), *thread->get_data());
+		}
+
+		if constexpr (has_container)
+			for (auto const& d : collected_data())
+				init = op(std::move(init), d);
+
+		return init;
+	}
+
+	// Same as 'reduce', but the data is moved into 'op' and reset.
+	// This clears all stored data.
+	template <typename U, typename BinaryOp>
+	static U reduce_and_reset(U init, BinaryOp&& op) {
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				init = op(std::move(init), std::exchange(*thread->get_data(), T{}));
+			}
+		}
+
+		if constexpr (has_container) {
+			for (auto& d : collected_data())
+				init = op(std::move(init), std::move(d));
+			collected_data().clear();
+		}
+
+		return init;
+	}
+
+	// Merges all the threads data and the data from expired threads with 'merge(T&&, T&&)',
+	// and returns the result. The data is merged pairwise in a tree, with the merges on each
+	// level running in parallel, so expensive merges take O(log threads) steps instead of
+	// one step per thread. Pairs are merged in the same order as the data is gathered in,
+	// so 'merge' must be associative, but does not have to be commutative.
+	// The merges run after the data is taken, without holding any lock.
+	// Returns a default constructed T if there is no data. This clears all stored data.
+	template <typename BinaryOp>
+	[[nodiscard]] static T combine(BinaryOp&& merge)
+		requires(std::is_invocable_r_v<T, BinaryOp&, T&&, T&&>)
+	{
+		std::vector<T> values;
+		{
+			reclaim_slots();
+			std::unique_lock ssl(snapshot_mtx);
+			std::unique_lock sl(mtx);
+			{
+				detail::reader_epoch::guard const g(readers);
+				cpu_slots_lock const cpu_lock;
+				for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+					values.push_back(std::exchange(*thread->get_data(), T{}));
+				}
+			}
+
+			if constexpr (has_container) {
+				for (auto& d : collected_data())
+					values.push_back(std::move(d));
+				collected_data().clear();
+			}
+		}
+
+		if (values.empty())
+			return T{};
+
+		// Merge 'values[i + stride]' into 'values[i]', doubling the stride on each level
+		std::vector<std::size_t> pairs;
+		for (std::size_t stride = 1; stride < values.size(); stride *= 2) {
+			pairs.clear();
+			for (std::size_t i = 0; i + stride < values.size(); i += 2 * stride)
+				pairs.push_back(i);
+
+			std::for_each(std::execution::par, pairs.begin(), pairs.end(), [&](std::size_t i) {
+				values[i] = merge(std::move(values[i]), std::move(values[i + stride]));
+			});
+		}
+
+		return std::move(values.front());
+	}
+
+	// Perform an action on all threads data
+	template <class Fn>
+	static void for_each(Fn&& fn) {
+		if constexpr (std::invocable<Fn, T const&>) {
+			std::shared_lock sl(mtx);
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data const* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				fn(*thread->get_data());
+			}
+
+			if constexpr (has_container)
+				for (auto const& d : collected_data())
+					fn(d);
+		} else {
+			std::unique_lock ssl(snapshot_mtx);
+			std::unique_lock sl(mtx);
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				fn(*thread->get_data());
+			}
+
+			if constexpr (has_container)
+				for (auto& d : collected_data())
+					fn(d);
+		}
+	}
+
+	// Perform an action on a snapshot of all threads data. The snapshot is taken
+	// without blocking threads from starting, and 'fn' is called after the snapshot
+	// is taken, so it can run for as long as it needs to. Exiting threads only wait
+	// for the threads to be read, which happens without locking 'mtx'.
+	// The data is read with relaxed atomic loads while the threads may be
+	// writing to it, so each value is as of some recent point in time. 'T' must
+	// be lock-free as an atomic, or be a std::array of such types.
+	template <class Fn>
+	static void for_each_snapshot(Fn&& fn)
+		requires(std::is_trivially_copyable_v<T> && std::invocable<Fn, T const&>)
+	{
+		std::vector<T> snapshot;
+		{
+			std::shared_lock ssl(snapshot_mtx);
+			detail::reader_epoch::guard const g(readers);
+			{
+				cpu_slots_lock const cpu_lock;
+				for (thread_data const* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+					snapshot.push_back(load_relaxed(*thread->get_data()));
+				}
+			}
+
+			// Read while the traversal is still active, so threads that exit after they were read
+			// above can not have moved their data here yet. 'mtx' is only locked after the per-cpu
+			// slots are unlocked, because gathers lock them while holding it.
+			if constexpr (has_container) {
+				std::shared_lock sl(mtx);
+				snapshot.insert(snapshot.end(), collected_data().begin(), collected_data().end());
+			}
+		}
+
+		for (T const& t : snapshot)
+			fn(t);
+	}
+
+	// Folds a snapshot of all threads data and the data from expired threads into 'init'
+	// using 'op(init, data)', and returns the result. Like 'for_each_snapshot', it does not
+	// block threads from starting, and the data is read with relaxed atomic loads.
+	// 'op' is called while the snapshot is taken, so it should be cheap.
+	template <typename U, typename BinaryOp>
+	[[nodiscard]] static U reduce_snapshot(U init, BinaryOp&& op)
+		requires(std::is_trivially_copyable_v<T>)
+	{
+		std::shared_lock ssl(snapshot_mtx);
+		detail::reader_epoch::guard const g(readers);
+		{
+			cpu_slots_lock const cpu_lock;
+			for (thread_data const* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				init = op(std::move(init), load_relaxed(*thread->get_data()));
+			}
+		}
+
+		// Read like in 'for_each_snapshot'
+		if constexpr (has_container) {
+			std::shared_lock sl(mtx);
+			for (auto const& d : collected_data())
+				init = op(std::move(init), d);
+		}
+
+		return init;
+	}
+
+	// Clears all data
+	static void clear() {
+		reclaim_slots();
+		std::unique_lock ssl(snapshot_mtx);
+		std::unique_lock sl(mtx);
+		{
+			detail::reader_epoch::guard const g(readers);
+			cpu_slots_lock const cpu_lock;
+			for (thread_data* thread = head.load(); thread != nullptr; thread = thread->get_next()) {
+				*(thread->get_data()) = {};
+			}
+		}
+
+		if constexpr (has_container)
+			collected_data().clear();
+	}
+};
+
+template <typename T, template<class...> typename Container = std::vector, auto U = [] {}>
+using unique_collect = collect<T, Container, decltype(U)>;
+
+} // namespace tls
+
+#endif // !TLS_COLLECT_H
@@ -0,0 +1,241 @@
+#ifndef TLS_CONCURRENT_VECTOR_H
+#define TLS_CONCURRENT_VECTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+#include "dynamic_collect.h"
+#include "detail/tls_model.h"
+
+namespace tls {
+// A container that any number of threads can append to concurrently. Each thread appends to its
+// own segments of 'segment_size' elements, which are allocated as needed and never reallocated,
+// so elements are never moved and references to them stay valid until the container is cleared.
+// The segments are aligned and padded to 'cache_line' to prevent false sharing.
+// Appending does not lock, except when a thread appends to the container for the first time.
+// The segments can be viewed in place with 'segments()', or moved into a single vector
+// with 'flatten_into' and 'sort_into'. These, and 'size', must not be called while threads are appending.
+template <typename T, std::size_t segment_size = 1024, std::size_t cache_line = 64UL>
+	requires(segment_size > 0)
+class concurrent_vector final {
+	static constexpr std::size_t element_alignment = std::max(cache_line, alignof(T));
+
+	// Storage for a fixed number of elements. The elements are owned by the 'segment_list' it is in.
+	struct alignas(element_alignment) segment final {
+		[[nodiscard]] T* data() noexcept {
+			return std::launder(reinterpret_cast<T*>(storage));
+		}
+
+		alignas(element_alignment) std::byte storage[segment_size * sizeof(T)];
+	};
+
+	// The segments of one thread. All the segments are full, except for the last one,
+	// which is filled up to 'cursor'.
+	struct segment_list final {
+		segment_list() = default;
+
+		segment_list(segment_list&& other) noexcept
+			: segments(std::exchange(other.segments, {})), cursor(std::exchange(other.cursor, nullptr)), limit(std::exchange(other.limit, nullptr)) {}
+
+		segment_list& operator=(segment_list&& other) noexcept {
+			if (this != &other) {
+				destroy();
+				segments = std::exchange(other.segments, {});
+				cursor = std::exchange(other.cursor, nullptr);
+				limit = std::exchange(other.limit, nullptr);
+			}
+			return *this;
+		}
+
+		~segment_list() {
+			destroy();
+		}
+
+		// Returns the number of elements in segment 'i'
+		[[nodiscard]] std::size_t size_of(std::size_t i) const noexcept {
+			if (i + 1 < segments.size())
+				return segment_size;
+			return static_cast<std::size_t>(cursor - segments[i]->data());
+		}
+
+		// Adds an empty segment. The storage is not initialized, as the elements are constructed in place.
+		void add_segment() {
+			segments.push_back(std::make_unique_for_overwrite<segment>());
+			cursor = segments.back()->data();
+			limit = cursor + segment_size;
+		}
+
+		// Destroys the elements and frees the segments
+		void destroy() noexcept {
+			for (std::size_t i = 0; i < segments.size(); i++)
+				std::destroy_n(segments[i]->data(), size_of(i));
+			segments.clear();
+			cursor = nullptr;
+			limit = nullptr;
+		}
+
+		std::vector<std::unique_ptr<segment>> segments;
+
+		// The next free element, and the end of the last segment
+		T* cursor = nullptr;
+		T* limit = nullptr;
+	};
+
+	// The segments of the vector the calling thread appended to last. The id tells instances apart,
+	// even if a new instance is created at the address of a destroyed one.
+	struct last_used final {
+		std::uint64_t id = 0;
+		segment_list* list = nullptr;
+	};
+	TLS_TLS_MODEL inline static constinit thread_local last_used last{};
+
+	inline static std::atomic<std::uint64_t> next_id{1};
+
+	// Returns the calling threads segments
+	[[nodiscard]] segment_list& local() {
+		if (last.id != id) [[unlikely]]
+			last = {id, &threads.local()};
+		return *last.list;
+	}
+
+	// Moves the elements into 'dest', and returns the offsets of the segments in it
+	std::vector<std::size_t> move_into(std::vector<T>& dest) {
+		std::vector<std::span<T>> const views = segments();
+		std::vector<std::size_t> offsets;
+		offsets.reserve(views.size() + 1);
+
+		std::size_t total = dest.size();
+		for (std::span<T> const view : views) {
+			offsets.push_back(total);
+			total += view.size();
+		}
+		offsets.push_back(total);
+
+		dest.resize(total);
+		std::vector<std::size_t> indices(views.size());
+		std::iota(indices.begin(), indices.end(), std::size_t{0});
+		std::for_each(std::execution::par, indices.begin(), indices.end(), [&](std::size_t i) {
+			std::move(views[i].begin(), views[i].end(), dest.begin() + static_cast<std::ptrdiff_t>(offsets[i]));
+		});
+
+		clear();
+		return offsets;
+	}
+
+public:
+	// Appends 'value' to the calling threads segments, and returns a reference to the new element
+	T& push_back(T const& value)
+		requires(std::copy_constructible<T>)
+	{
+		return emplace_back(value);
+	}
+
+	T& push_back(T&& value)
+		requires(std::move_constructible<T>)
+	{
+		return emplace_back(std::move(value));
+	}
+
+	// Constructs an element at the end of the calling threads segments, and returns a reference to it
+	template <typename... Args>
+	T& emplace_back(Args&&... args) {
+		segment_list& list = local();
+		if (list.cursor == list.limit) [[unlikely]]
+			list.add_segment();
+
+		T* const element = std::construct_at(list.cursor, std::forward<Args>(args)...);
+		list.cursor++;
+		return *element;
+	}
+
+	// Returns the number of elements. Like 'segments()', this must not be called while threads
+	// are appending, because their lists of segments may grow while they are read.
+	[[nodiscard]] std::size_t size() const {
+		return threads.reduce(std::size_t{0}, [](std::size_t n, segment_list const& list) {
+			for (std::size_t i = 0; i < list.segments.size(); i++)
+				n += list.size_of(i);
+			return n;
+		});
+	}
+
+	// Returns true if there are no elements. This must not be called while threads are appending.
+	[[nodiscard]] bool empty() const {
+		return size() == 0;
+	}
+
+	// Returns a view of each segment, in no specific order. The elements are not copied,
+	// and the views are valid until the container is cleared.
+	[[nodiscard]] std::vector<std::span<T>> segments() {
+		std::vector<std::span<T>> views;
+		threads.for_each([&views](segment_list& list) {
+			for (std::size_t i = 0; i < list.segments.size(); i++)
+				views.emplace_back(list.segments[i]->data(), list.size_of(i));
+		});
+		return views;
+	}
+
+	// Moves all the elements to the end of 'dest', which is resized once to fit them.
+	// The segments are moved concurrently. This clears the container.
+	void flatten_into(std::vector<T>& dest)
+		requires(std::default_initializable<T> && std::movable<T>)
+	{
+		(void)move_into(dest);
+	}
+
+	// Moves all the elements to the end of 'dest', and sorts them with 'comp'. The segments are
+	// moved and sorted concurrently, and then merged pairwise in parallel. The elements that were
+	// already in 'dest' are not sorted. This clears the container.
+	template <typename Compare = std::less<>>
+	void sort_into(std::vector<T>& dest, Compare comp = {})
+		requires(std::default_initializable<T> && std::movable<T>)
+	{
+		std::vector<std::size_t> const offsets = move_into(dest);
+		std::size_t const runs = offsets.size() - 1;
+		auto const at = [&dest](std::size_t offset) {
+			return dest.begin() + static_cast<std::ptrdiff_t>(offset);
+		};
+
+		std::vector<std::size_t> indices(runs);
+		std::iota(indices.begin(), indices.end(), std::size_t{0});
+		std::for_each(std::execution::par, indices.begin(), indices.end(), [&](std::size_t i) {
+			std::sort(at(offsets[i]), at(offsets[i + 1]), comp);
+		});
+
+		// Merge run 'i + stride' into run 'i', doubling the stride on each level
+		for (std::size_t stride = 1; stride < runs; stride *= 2) {
+			indices.clear();
+			for (std::size_t i = 0; i + stride < runs; i += 2 * stride)
+				indices.push_back(i);
+
+			std::for_each(std::execution::par, indices.begin(), indices.end(), [&](std::size_t i) {
+				std::size_t const last = std::min(i + 2 * stride, runs);
+				std::inplace_merge(at(offsets[i]), at(offsets[i + stride]), at(offsets[last]), comp);
+			});
+		}
+	}
+
+	// Destroys all the elements and frees the segments
+	void clear() {
+		threads.clear();
+	}
+
+private:
+	// Identifies this instance in 'last'
+	std::uint64_t const id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+	dynamic_collect<segment_list> threads;
+};
+
+} // namespace tls
+
+#endif // !TLS_CONCURRENT_VECTOR_H
@@ -0,0 +1,73 @@
+#ifndef TLS_COUNTER_H
+#define TLS_COUNTER_H
+
+#include <atomic>
+#include <concepts>
+#include <functional>
+#include "collect.h"
+#include "detail/expiring_threads.h"
+#include "detail/tls_model.h"
+
+namespace tls {
+// A sharded counter. Each thread adds to its own thread-local counter, which only the
+// owning thread writes to, so adding is a plain load and store without any locked instructions.
+// The counters can be read from any thread at any time, without blocking the threads adding to them.
+// Counts from expired threads are preserved. Reads retry while threads exit, so they are not lock-free.
+// Use `tls::unique_counter` or pass different types to 'UnusedDifferentiatorType'
+// to create different types.
+template <std::integral T, typename UnusedDifferentiatorType = void>
+class counter final {
+	using slots = collect<T, none, counter>;
+
+	// Moves the threads count to 'expired' when the thread exits
+	struct thread_slot final {
+		thread_slot() noexcept : value(slots::local()) {}
+
+		~thread_slot() {
+			expiring.expire([this] {
+				expired.fetch_add(value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				value.store(T{0}, std::memory_order_relaxed);
+			});
+		}
+
+		std::atomic_ref<T> value;
+	};
+
+	static std::atomic_ref<T>& local() noexcept {
+		TLS_TLS_MODEL thread_local thread_slot slot{};
+		return slot.value;
+	}
+
+	// The sum of the counts from expired threads
+	inline static std::atomic<T> expired{0};
+
+	// Used by 'read' to detect threads that exited while it was summing
+	inline static detail::expiring_threads expiring;
+
+public:
+	// Adds 'value' to the threads counter
+	static void add(T value) noexcept {
+		std::atomic_ref<T>& v = local();
+		v.store(v.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	// Subtracts 'value' from the threads counter
+	static void sub(T value) noexcept {
+		std::atomic_ref<T>& v = local();
+		v.store(v.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+	}
+
+	// Returns the sum of all the threads counters, including the ones from expired threads
+	[[nodiscard]] static T read() noexcept {
+		return expiring.read([] {
+			return slots::reduce_snapshot(expired.load(std::memory_order_relaxed), std::plus<T>{});
+		});
+	}
+};
+
+template <std::integral T, auto U = [] {}>
+using unique_counter = counter<T, decltype(U)>;
+
+} // namespace tls
+
+#endif // !TLS_COUNTER_H
@@ -0,0 +1,60 @@
+#ifndef TLS_DETAIL_CPU_H
+#define TLS_DETAIL_CPU_H
+
+#if defined(_WIN32)
+// The functions are declared here instead of including <windows.h>, so users of the library
+// don't get its macros. The declarations are the same as the ones in the Windows headers.
+struct _PROCESSOR_NUMBER;
+extern "C" {
+__declspec(dllimport) unsigned long __stdcall GetCurrentProcessorNumber();
+__declspec(dllimport) void __stdcall GetCurrentProcessorNumberEx(_PROCESSOR_NUMBER* ProcNumber);
+__declspec(dllimport) int __stdcall GetNumaProcessorNodeEx(_PROCESSOR_NUMBER* Processor, unsigned short* NodeNumber);
+}
+#elif defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tls::detail {
+// Returns the cpu the calling thread is running on, or 0 if it can't be found.
+// The thread can be moved to another cpu at any time, so the result is only a hint.
+inline unsigned current_cpu() noexcept {
+#if defined(_WIN32)
+	return GetCurrentProcessorNumber();
+#elif defined(__linux__)
+	int const cpu = sched_getcpu();
+	return cpu < 0 ? 0u : static_cast<unsigned>(cpu);
+#else
+	return 0;
+#endif
+}
+
+// Returns the NUMA node of the cpu the calling thread is running on, or 0 if it can't be found.
+// Like 'current_cpu', the result is only a hint.
+inline unsigned current_numa_node() noexcept {
+#if defined(_WIN32)
+	// The layout of 'PROCESSOR_NUMBER'
+	struct processor_number {
+		unsigned short group;
+		unsigned char number;
+		unsigned char reserved;
+	} processor{};
+	auto* const p = reinterpret_cast<_PROCESSOR_NUMBER*>(&processor);
+	GetCurrentProcessorNumberEx(p);
+	unsigned short node = 0;
+	if (GetNumaProcessorNodeEx(p, &node))
+		return node;
+	return 0;
+#elif defined(__linux__)
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+		return node;
+	return 0;
+#else
+	return 0;
+#endif
+}
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_CPU_H
@@ -0,0 +1,51 @@
+#ifndef TLS_DETAIL_EXPIRING_THREADS_H
+#define TLS_DETAIL_EXPIRING_THREADS_H
+
+#include <atomic>
+#include <thread>
+
+namespace tls::detail {
+// Used by the sharded types, like 'tls::counter'. Their reads sum the data of the live threads
+// and the data that expired threads have moved out of their slots. A thread that moves its data
+// while a read is summing might be counted twice or not at all, so the read is retried.
+// Threads move their data from a thread_local that is created after their slot in 'tls::collect',
+// so it is destroyed while the slot can still be seen by the reads.
+class expiring_threads final {
+public:
+	// Runs 'move_data', which moves the data of the exiting thread out of its slot
+	template <class Fn>
+	void expire(Fn&& move_data) noexcept {
+		exiting.fetch_add(1);
+
+		// A read that sees any of the moved data also sees 'exiting', through the fence in 'read'
+		std::atomic_thread_fence(std::memory_order_release);
+		move_data();
+
+		exits.fetch_add(1);
+		exiting.fetch_sub(1);
+	}
+
+	// Returns the result of 'read_data' from a run that no exiting thread overlapped with.
+	// It is retried for as long as threads keep exiting, so this is not lock-free.
+	template <class Fn>
+	[[nodiscard]] auto read(Fn&& read_data) const {
+		while (true) {
+			unsigned const exits_before = exits.load();
+			if (exiting.load() == 0) {
+				auto result = read_data();
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (exiting.load() == 0 && exits.load() == exits_before)
+					return result;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	std::atomic<unsigned> exiting{0};
+	std::atomic<unsigned> exits{0};
+};
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_EXPIRING_THREADS_H
@@ -0,0 +1,104 @@
+#ifndef TLS_DETAIL_INSTANCE_TABLE_H
+#define TLS_DETAIL_INSTANCE_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "tls_model.h"
+
+namespace tls::detail {
+// Maps instances of 'Owner' to per-thread slots, for classes where each instance
+// needs its own thread-local data. Every instance gets an index into a thread-local
+// table of slot pointers, so finding a threads slot is a bounds check and a load.
+// Indices are reused when instances are destroyed, so each entry also stores the
+// generation of the instance it belongs to, which detects stale entries.
+// 'Owner' must provide 'void release_slot(Slot*)', which is called when a thread that
+// has a slot in the instance exits.
+template <typename Owner, typename Slot>
+class instance_table final {
+	struct entry {
+		Slot* slot = nullptr;
+		std::uint64_t generation = 0;
+	};
+
+	struct instance {
+		Owner* owner = nullptr;
+		std::uint64_t generation = 0;
+	};
+
+	// The threads part of the table. Hands the slots back to the instances when the thread exits.
+	struct thread_table final {
+		~thread_table() {
+			std::scoped_lock sl(mtx);
+			for (std::size_t i = 0; i < entries.size(); i++) {
+				entry const& e = entries[i];
+				if (e.slot != nullptr && instances[i].generation == e.generation)
+					instances[i].owner->release_slot(e.slot);
+			}
+		}
+
+		std::vector<entry> entries;
+	};
+
+	static std::vector<entry>& local_entries() noexcept {
+		TLS_TLS_MODEL thread_local thread_table table;
+		return table.entries;
+	}
+
+	// Serializes access to the instances, and lets 'remove' wait for exiting threads
+	inline static std::mutex mtx;
+	inline static std::vector<instance> instances;
+	inline static std::vector<std::size_t> free_indices;
+	inline static std::uint64_t next_generation = 1;
+
+public:
+	// Identifies an instance in the table
+	struct handle {
+		std::size_t index;
+		std::uint64_t generation;
+	};
+
+	// Adds an instance to the table
+	static handle add(Owner* owner) {
+		std::scoped_lock sl(mtx);
+
+		std::size_t index = instances.size();
+		if (free_indices.empty()) {
+			instances.emplace_back();
+		} else {
+			index = free_indices.back();
+			free_indices.pop_back();
+		}
+
+		instances[index] = {owner, next_generation++};
+		return {index, instances[index].generation};
+	}
+
+	// Removes an instance from the table. No thread will call 'release_slot' on
+	// the instance after this returns, so it can free its slots.
+	static void remove(handle h) {
+		std::scoped_lock sl(mtx);
+		instances[h.index] = {};
+		free_indices.push_back(h.index);
+	}
+
+	// Returns the calling threads slot in the instance, or nullptr if it has none
+	[[nodiscard]] static Slot* find(handle h) noexcept {
+		std::vector<entry> const& entries = local_entries();
+		if (h.index < entries.size() && entries[h.index].generation == h.generation)
+			return entries[h.index].slot;
+		return nullptr;
+	}
+
+	// Sets the calling threads slot in the instance
+	static void bind(handle h, Slot* slot) {
+		std::vector<entry>& entries = local_entries();
+		if (entries.size() <= h.index)
+			entries.resize(h.index + 1);
+		entries[h.index] = {slot, h.generation};
+	}
+};
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_INSTANCE_TABLE_H
@@ -0,0 +1,22 @@
+#ifndef TLS_DETAIL_NO_UNIQUE_ADDRESS_H
+#define TLS_DETAIL_NO_UNIQUE_ADDRESS_H
+
+// '[[no_unique_address]]' lets empty members, like the policies of 'tls::cache', take up no space.
+// MSVC accepts the standard attribute but ignores it, and only honors its own spelling.
+#if defined(_MSC_VER)
+#define TLS_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#else
+#define TLS_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#endif
+
+namespace tls::detail {
+// The sizes of the caches depend on this, so fail here instead of silently changing their layout
+struct no_unique_address_check {
+	struct empty {};
+	int value;
+	TLS_NO_UNIQUE_ADDRESS empty e;
+};
+static_assert(sizeof(no_unique_address_check) == sizeof(int), "the compiler does not support TLS_NO_UNIQUE_ADDRESS");
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_NO_UNIQUE_ADDRESS_H
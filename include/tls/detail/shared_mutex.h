@@ -0,0 +1,148 @@
+#ifndef TLS_DETAIL_SHARED_MUTEX_H
+#define TLS_DETAIL_SHARED_MUTEX_H
+
+#include <shared_mutex>
+
+#ifdef TLS_LOCK_INSTRUMENTATION
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#endif
+
+#ifdef TLS_LOCK_INSTRUMENTATION
+namespace tls {
+// The times a thread waited for, and then held, one of the librarys shared mutexes
+struct lock_event {
+	// The class the mutex belongs to, like "tls::collect"
+	char const* name;
+	// True for unique locks, false for shared locks
+	bool exclusive;
+	std::chrono::nanoseconds wait;
+	std::chrono::nanoseconds hold;
+};
+
+// Called when a lock is released. It is called on the thread that held the lock,
+// right after unlocking it, so it should be cheap and must not lock the same mutex.
+using lock_hook = void (*)(lock_event const&) noexcept;
+
+namespace detail {
+inline std::atomic<lock_hook> current_lock_hook{nullptr};
+} // namespace detail
+
+// Sets the function that is called with the wait and hold times of the librarys shared mutexes,
+// or nullptr to stop calling it. Only available when 'TLS_LOCK_INSTRUMENTATION' is defined.
+inline void set_lock_hook(lock_hook hook) noexcept {
+	detail::current_lock_hook.store(hook, std::memory_order_release);
+}
+} // namespace tls
+#endif
+
+namespace tls::detail {
+#ifndef TLS_LOCK_INSTRUMENTATION
+// The shared mutex used by the library. Define 'TLS_LOCK_INSTRUMENTATION' to report
+// the wait and hold times of its locks to the function passed to 'tls::set_lock_hook'.
+class shared_mutex final : public std::shared_mutex {
+public:
+	explicit shared_mutex(char const*) noexcept {}
+};
+#else
+class shared_mutex final {
+	using clock = std::chrono::steady_clock;
+
+	// The shared locks held by a thread, how long it waited for them, and when they were taken
+	struct shared_hold {
+		shared_mutex const* mutex = nullptr;
+		clock::duration wait{};
+		clock::time_point start{};
+	};
+	static constexpr std::size_t max_shared_holds = 8;
+
+	static shared_hold* shared_holds() noexcept {
+		thread_local shared_hold holds[max_shared_holds]{};
+		return holds;
+	}
+
+	// Remembers a shared lock that was just taken. Locks beyond 'max_shared_holds' are not reported.
+	void add_shared_hold(clock::duration wait, clock::time_point start) const noexcept {
+		for (std::size_t i = 0; i < max_shared_holds; i++) {
+			shared_hold& h = shared_holds()[i];
+			if (h.mutex == nullptr) {
+				h = {this, wait, start};
+				return;
+			}
+		}
+	}
+
+	void report(bool exclusive, clock::duration wait, clock::time_point start) const noexcept {
+		if (lock_hook const hook = current_lock_hook.load(std::memory_order_acquire); hook != nullptr)
+			hook({name, exclusive, std::chrono::duration_cast<std::chrono::nanoseconds>(wait),
+				  std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start)});
+	}
+
+public:
+	explicit shared_mutex(char const* name) noexcept : name(name) {}
+
+	shared_mutex(shared_mutex const&) = delete;
+	shared_mutex& operator=(shared_mutex const&) = delete;
+
+	void lock() {
+		clock::time_point const before = clock::now();
+		mtx.lock();
+		clock::time_point const now = clock::now();
+		unique_wait = now - before;
+		unique_start = now;
+	}
+
+	bool try_lock() {
+		if (!mtx.try_lock())
+			return false;
+		unique_wait = {};
+		unique_start = clock::now();
+		return true;
+	}
+
+	void unlock() {
+		clock::duration const wait = unique_wait;
+		clock::time_point const start = unique_start;
+		mtx.unlock();
+		report(true, wait, start);
+	}
+
+	void lock_shared() {
+		clock::time_point const before = clock::now();
+		mtx.lock_shared();
+		clock::time_point const now = clock::now();
+		add_shared_hold(now - before, now);
+	}
+
+	bool try_lock_shared() {
+		if (!mtx.try_lock_shared())
+			return false;
+		add_shared_hold({}, clock::now());
+		return true;
+	}
+
+	void unlock_shared() {
+		mtx.unlock_shared();
+		for (std::size_t i = 0; i < max_shared_holds; i++) {
+			shared_hold& h = shared_holds()[i];
+			if (h.mutex == this) {
+				h.mutex = nullptr;
+				report(false, h.wait, h.start);
+				break;
+			}
+		}
+	}
+
+private:
+	std::shared_mutex mtx;
+	char const* name;
+
+	// Only written by the thread holding the unique lock
+	clock::duration unique_wait{};
+	clock::time_point unique_start{};
+};
+#endif
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_SHARED_MUTEX_H
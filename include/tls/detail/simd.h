@@ -0,0 +1,167 @@
+#ifndef TLS_DETAIL_SIMD_H
+#define TLS_DETAIL_SIMD_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TLS_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TLS_SIMD_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define TLS_SIMD_NEON
+#endif
+
+namespace tls::detail {
+// Keys that can be compared by their bits with vector instructions
+template <class Key>
+constexpr bool simd_comparable = (std::is_integral_v<Key> || std::is_enum_v<Key>) &&
+								 (sizeof(Key) == 1 || sizeof(Key) == 2 || sizeof(Key) == 4 || sizeof(Key) == 8);
+
+// Returns a mask with bit 'i' set for every 'keys[i]' that is equal to 'key'
+template <class Key, std::size_t N>
+	requires(N <= 64)
+constexpr std::uint64_t match_mask(Key const (&keys)[N], Key const key) noexcept {
+	std::uint64_t mask = 0;
+	std::size_t i = 0;
+
+	if constexpr (simd_comparable<Key>) {
+		if (!std::is_constant_evaluated()) {
+#if defined(TLS_SIMD_AVX2)
+			constexpr std::size_t per_chunk = 32 / sizeof(Key);
+			__m256i needle;
+			if constexpr (sizeof(Key) == 1)
+				needle = _mm256_set1_epi8(std::bit_cast<char>(key));
+			else if constexpr (sizeof(Key) == 2)
+				needle = _mm256_set1_epi16(std::bit_cast<short>(key));
+			else if constexpr (sizeof(Key) == 4)
+				needle = _mm256_set1_epi32(std::bit_cast<int>(key));
+			else
+				needle = _mm256_set1_epi64x(std::bit_cast<long long>(key));
+
+			// Returns the matches of the keys starting at 'at'
+			auto const compare = [&](std::size_t at) noexcept -> std::uint64_t {
+				__m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + at));
+				std::uint64_t bits;
+				if constexpr (sizeof(Key) == 1) {
+					bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+				} else if constexpr (sizeof(Key) == 2) {
+					// Pack the 16-bit results to bytes, and fix the lane order
+					__m256i const eq = _mm256_cmpeq_epi16(chunk, needle);
+					__m256i const packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(eq, _mm256_setzero_si256()), 0b11'01'10'00);
+					bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(packed)) & 0xFFFF;
+				} else if constexpr (sizeof(Key) == 4) {
+					bits = static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, needle))));
+				} else {
+					bits = static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(chunk, needle))));
+				}
+				return bits;
+			};
+#elif defined(TLS_SIMD_SSE2)
+			constexpr std::size_t per_chunk = 16 / sizeof(Key);
+			__m128i needle;
+			if constexpr (sizeof(Key) == 1)
+				needle = _mm_set1_epi8(std::bit_cast<char>(key));
+			else if constexpr (sizeof(Key) == 2)
+				needle = _mm_set1_epi16(std::bit_cast<short>(key));
+			else if constexpr (sizeof(Key) == 4)
+				needle = _mm_set1_epi32(std::bit_cast<int>(key));
+			else
+				needle = _mm_set1_epi64x(std::bit_cast<long long>(key));
+
+			// Returns the matches of the keys starting at 'at'
+			auto const compare = [&](std::size_t at) noexcept -> std::uint64_t {
+				__m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + at));
+				std::uint64_t bits;
+				if constexpr (sizeof(Key) == 1) {
+					bits = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+				} else if constexpr (sizeof(Key) == 2) {
+					__m128i const eq = _mm_cmpeq_epi16(chunk, needle);
+					bits = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()))) & 0xFF;
+				} else if constexpr (sizeof(Key) == 4) {
+					bits = static_cast<std::uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(chunk, needle))));
+				} else {
+					// SSE2 has no 64-bit compare, so both 32-bit halves must be equal
+					__m128i eq = _mm_cmpeq_epi32(chunk, needle);
+					eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+					bits = static_cast<std::uint32_t>(_mm_movemask_pd(_mm_castsi128_pd(eq)));
+				}
+				return bits;
+			};
+#elif defined(TLS_SIMD_NEON)
+			constexpr std::size_t per_chunk = 16 / sizeof(Key);
+			// Returns the matches of the keys starting at 'at'
+			auto const compare = [&](std::size_t at) noexcept -> std::uint64_t {
+				uint8x16_t eq;
+				if constexpr (sizeof(Key) == 1) {
+					uint8_t needle;
+					std::memcpy(&needle, &key, sizeof(Key));
+					eq = vceqq_u8(vld1q_u8(reinterpret_cast<uint8_t const*>(keys + at)), vdupq_n_u8(needle));
+				} else if constexpr (sizeof(Key) == 2) {
+					uint16_t needle;
+					std::memcpy(&needle, &key, sizeof(Key));
+					eq = vreinterpretq_u8_u16(vceqq_u16(vld1q_u16(reinterpret_cast<uint16_t const*>(keys + at)), vdupq_n_u16(needle)));
+				} else if constexpr (sizeof(Key) == 4) {
+					uint32_t needle;
+					std::memcpy(&needle, &key, sizeof(Key));
+					eq = vreinterpretq_u8_u32(vceqq_u32(vld1q_u32(reinterpret_cast<uint32_t const*>(keys + at)), vdupq_n_u32(needle)));
+				} else {
+					uint64_t needle;
+					std::memcpy(&needle, &key, sizeof(Key));
+					eq = vreinterpretq_u8_u64(vceqq_u64(vld1q_u64(reinterpret_cast<uint64_t const*>(keys + at)), vdupq_n_u64(needle)));
+				}
+
+				// Narrow each byte of the result to 4 bits, and take one bit per key
+				std::uint64_t const nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+				std::uint64_t bits = 0;
+				for (std::size_t j = 0; j < per_chunk; j++)
+					bits |= ((nibbles >> (j * sizeof(Key) * 4)) & 1) << j;
+				return bits;
+			};
+#endif
+
+#if defined(TLS_SIMD_AVX2) || defined(TLS_SIMD_SSE2) || defined(TLS_SIMD_NEON)
+			for (; i + per_chunk <= N; i += per_chunk)
+				mask |= compare(i) << i;
+
+			// Compare the remaining keys with a chunk that overlaps the previous one
+			if constexpr (N > per_chunk && N % per_chunk != 0) {
+				mask |= compare(N - per_chunk) << (N - per_chunk);
+				i = N;
+			}
+#endif
+		}
+	}
+
+	// The keys that don't fill a vector
+	for (; i < N; i++)
+		mask |= std::uint64_t{keys[i] == key} << i;
+
+	return mask;
+}
+
+// Returns the index of the first 'keys[i]' that is equal to 'key', or 'N' if there is none
+template <class Key, std::size_t N>
+constexpr std::size_t find_key(Key const (&keys)[N], Key const key) noexcept {
+	if constexpr (N <= 64) {
+		std::uint64_t const mask = match_mask(keys, key);
+		return mask == 0 ? N : static_cast<std::size_t>(std::countr_zero(mask));
+	} else {
+		std::size_t index = N;
+		for (std::size_t i = N; i-- > 0;) {
+			// no break generates cmov's instead of jumps
+			if (key == keys[i])
+				index = i;
+		}
+		return index;
+	}
+}
+} // namespace tls::detail
+
+#endif // !TLS_DETAIL_SIMD_H
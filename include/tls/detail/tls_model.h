@@ -0,0 +1,16 @@
+#ifndef TLS_DETAIL_TLS_MODEL_H
+#define TLS_DETAIL_TLS_MODEL_H
+
+// Define 'TLS_THREAD_LOCAL_MODEL' to one of "global-dynamic", "local-dynamic", "initial-exec" or
+// "local-exec" to choose the TLS model of the librarys thread_local variables on gcc and clang.
+// Code in shared libraries uses "global-dynamic" by default, which calls '__tls_get_addr' on every
+// access. "initial-exec" avoids the call, but the shared library can then fail to load with
+// 'dlopen' if the static TLS space of the process is used up.
+// The cmake option of the same name sets it for the 'tls' target.
+#if defined(TLS_THREAD_LOCAL_MODEL) && (defined(__GNUC__) || defined(__clang__))
+#define TLS_TLS_MODEL [[gnu::tls_model(TLS_THREAD_LOCAL_MODEL)]]
+#else
+#define TLS_TLS_MODEL
+#endif
+
+#endif // !TLS_DETAIL_TLS_MODEL_H
@@ -0,0 +1,197 @@
+#ifndef TLS_DYNAMIC_COLLECT_H
+#define TLS_DYNAMIC_COLLECT_H
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include <concepts>
+#include "collect.h"
+#include "detail/instance_table.h"
+#include "detail/no_unique_address.h"
+#include "detail/shared_mutex.h"
+
+namespace tls {
+// Like 'tls::collect', but each instance has its own thread-local data, instead of
+// all instances with the same template arguments sharing it. This allows
+// collectors to be created at runtime, like one per request.
+// Destroying an instance frees the data of all the threads that accessed it.
+// The lock only protects the list of threads, not their data, so the functions that read
+// or gather the data, and the destructor, must not run while a thread is modifying its data.
+// Each threads data is aligned and padded to 'cache_line' to prevent false sharing.
+template <typename T, template <class...> typename Container = std::vector, std::size_t cache_line = 64UL>
+class dynamic_collect final {
+	static constexpr std::size_t data_alignment = std::max(cache_line, alignof(T));
+	static constexpr bool has_container = not std::same_as<Container<T>, none<T>>;
+
+	// The data of one thread in one instance
+	struct alignas(data_alignment) slot final {
+		slot* prev = nullptr;
+		slot* next = nullptr;
+		alignas(data_alignment) T data{};
+	};
+
+	using table = detail::instance_table<dynamic_collect, slot>;
+	friend table;
+
+	// Creates the calling threads slot
+	[[nodiscard]] T& init_thread() {
+		slot* s = new slot{};
+		{
+			std::unique_lock sl(mtx);
+			s->next = head;
+			if (head != nullptr)
+				head->prev = s;
+			head = s;
+		}
+		table::bind(handle, s);
+		return s->data;
+	}
+
+	// Removes the slot of an exiting thread
+	void release_slot(slot* s) {
+		std::unique_lock sl(mtx);
+
+		if constexpr (has_container) {
+			// Take the thread data
+			collected_data.push_back(std::move(s->data));
+		}
+
+		// Remove the thread from the linked list
+		if (s->prev != nullptr)
+			s->prev->next = s->next;
+		else
+			head = s->next;
+		if (s->next != nullptr)
+			s->next->prev = s->prev;
+
+		delete s;
+	}
+
+public:
+	dynamic_collect() : handle(table::add(this)) {}
+
+	~dynamic_collect() {
+		// No thread can release its slot after this
+		table::remove(handle);
+
+		for (slot* s = head; s != nullptr;) {
+			slot* next = s->next;
+			delete s;
+			s = next;
+		}
+	}
+
+	dynamic_collect(dynamic_collect const&) = delete;
+	dynamic_collect& operator=(dynamic_collect const&) = delete;
+
+	// Get the thread-local variable
+	[[nodiscard]] T& local() {
+		if (slot* s = table::find(handle); s != nullptr)
+			return s->data;
+		return init_thread();
+	}
+
+	// Gathers all the threads data and returns it. This clears all stored data.
+	[[nodiscard]] Container<T> gather()
+		requires(has_container)
+	{
+		std::unique_lock sl(mtx);
+
+		Container<T> data = std::move(collected_data);
+		collected_data = {};
+		for (slot* s = head; s != nullptr; s = s->next) {
+			data.push_back(std::move(s->data));
+			s->data = T{};
+		}
+
+		return data;
+	}
+
+	// Gathers all the threads data and sends it to the output iterator. This clears all stored data.
+	void gather_flattened(auto dest_iterator)
+		requires(std::ranges::range<T> && has_container)
+	{
+		std::unique_lock sl(mtx);
+
+		for (T& per_thread_data : collected_data) {
+			dest_iterator = std::move(per_thread_data.begin(), per_thread_data.end(), dest_iterator);
+		}
+		collected_data.clear();
+
+		for (slot* s = head; s != nullptr; s = s->next) {
+			dest_iterator = std::move(s->data.begin(), s->data.end(), dest_iterator);
+			s->data.clear();
+		}
+	}
+
+	// Folds all the threads data and the data from expired threads into 'init'
+	// using 'op(init, data)', and returns the result. The data is not modified.
+	// Must not run while a thread is modifying its data.
+	template <typename U, typename BinaryOp>
+	[[nodiscard]] U reduce(U init, BinaryOp&& op) const {
+		std::shared_lock sl(mtx);
+		for (slot const* s = head; s != nullptr; s = s->next) {
+			init = op(std::move(init), s->data);
+		}
+
+		if constexpr (has_container)
+			for (auto const& d : collected_data)
+				init = op(std::move(init), d);
+
+		return init;
+	}
+
+	// Perform an action on all threads data
+	template <class Fn>
+	void for_each(Fn&& fn) {
+		if constexpr (std::invocable<Fn, T const&>) {
+			std::shared_lock sl(mtx);
+			for (slot const* s = head; s != nullptr; s = s->next) {
+				fn(s->data);
+			}
+
+			if constexpr (has_container)
+				for (auto const& d : collected_data)
+					fn(d);
+		} else {
+			std::unique_lock sl(mtx);
+			for (slot* s = head; s != nullptr; s = s->next) {
+				fn(s->data);
+			}
+
+			if constexpr (has_container)
+				for (auto& d : collected_data)
+					fn(d);
+		}
+	}
+
+	// Clears all data
+	void clear() {
+		std::unique_lock sl(mtx);
+		for (slot* s = head; s != nullptr; s = s->next) {
+			s->data = {};
+		}
+
+		if constexpr (has_container)
+			collected_data.clear();
+	}
+
+private:
+	// This instances index in the threads tables
+	typename table::handle const handle;
+
+	// The head of the threads
+	slot* head = nullptr;
+
+	// Mutex for serializing access to the threads data and the collected data
+	mutable detail::shared_mutex mtx{"tls::dynamic_collect"};
+
+	// The data collected from exited threads
+	TLS_NO_UNIQUE_ADDRESS Container<T> collected_data{};
+};
+
+} // namespace tls
+
+#endif // !TLS_DYNAMIC_COLLECT_H
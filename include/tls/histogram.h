@@ -0,0 +1,184 @@
+#ifndef TLS_HISTOGRAM_H
+#define TLS_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "collect.h"
+#include "detail/expiring_threads.h"
+
+namespace tls {
+// A sharded histogram of 64-bit values, like latencies. Each thread records into its own
+// cache line aligned buckets, which only the owning thread writes to, so recording is a plain
+// load and store without any locked instructions. The histograms can be read from any thread
+// at any time, without blocking the threads recording into them. Counts from expired threads are preserved.
+// Reads retry while threads exit, so they are not lock-free.
+// The buckets are log-linear: values below 2^sub_bucket_bits get a bucket each, and every power
+// of two above that is split into 2^sub_bucket_bits buckets, so the relative error of a values
+// bucket is less than 1 / 2^sub_bucket_bits.
+// Use `tls::unique_histogram` or pass different types to 'UnusedDifferentiatorType'
+// to create different types.
+template <unsigned sub_bucket_bits = 5, typename UnusedDifferentiatorType = void>
+	requires(sub_bucket_bits >= 1 && sub_bucket_bits < 16)
+class histogram final {
+	static constexpr std::uint64_t sub_buckets = std::uint64_t{1} << sub_bucket_bits;
+
+public:
+	// The number of buckets needed to cover all 64-bit values
+	static constexpr std::size_t num_buckets = (65 - sub_bucket_bits) * sub_buckets;
+
+	// Returns the index of the bucket that 'value' is counted in
+	[[nodiscard]] static constexpr std::size_t bucket_of(std::uint64_t value) noexcept {
+		if (value < sub_buckets)
+			return static_cast<std::size_t>(value);
+
+		unsigned const shift = static_cast<unsigned>(std::bit_width(value)) - 1 - sub_bucket_bits;
+		return static_cast<std::size_t>((shift + 1) * sub_buckets + ((value >> shift) - sub_buckets));
+	}
+
+	// Returns the smallest value that is counted in bucket 'index'
+	[[nodiscard]] static constexpr std::uint64_t lowest_value(std::size_t index) noexcept {
+		if (index < sub_buckets)
+			return index;
+
+		std::uint64_t const block = index / sub_buckets;
+		return (sub_buckets + index % sub_buckets) << (block - 1);
+	}
+
+	// Returns the largest value that is counted in bucket 'index'
+	[[nodiscard]] static constexpr std::uint64_t highest_value(std::size_t index) noexcept {
+		return index + 1 == num_buckets ? UINT64_MAX : lowest_value(index + 1) - 1;
+	}
+
+	// The merged counts of all the threads at some recent point in time
+	class snapshot final {
+	public:
+		// The count of each bucket
+		[[nodiscard]] std::span<std::uint64_t const, num_buckets> buckets() const noexcept {
+			return std::span<std::uint64_t const, num_buckets>{counts.data(), num_buckets};
+		}
+
+		// The number of recorded values
+		[[nodiscard]] std::uint64_t count() const noexcept {
+			return total;
+		}
+
+		// Returns the highest value of the bucket that holds the 'p'th percentile,
+		// which is in the range [0, 100], or 0 if no values are recorded
+		[[nodiscard]] std::uint64_t percentile(double p) const noexcept {
+			if (total == 0)
+				return 0;
+
+			double const clamped = std::clamp(p, 0.0, 100.0);
+			std::uint64_t const rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(clamped / 100.0 * static_cast<double>(total) + 0.5));
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < num_buckets; i++) {
+				seen += counts[i];
+				if (seen >= rank)
+					return highest_value(i);
+			}
+			return highest_value(num_buckets - 1);
+		}
+
+		// The lowest value of the lowest non-empty bucket, or 0 if no values are recorded
+		[[nodiscard]] std::uint64_t min() const noexcept {
+			for (std::size_t i = 0; i < num_buckets; i++)
+				if (counts[i] != 0)
+					return lowest_value(i);
+			return 0;
+		}
+
+		// The highest value of the highest non-empty bucket, or 0 if no values are recorded
+		[[nodiscard]] std::uint64_t max() const noexcept {
+			for (std::size_t i = num_buckets; i-- > 0;)
+				if (counts[i] != 0)
+					return highest_value(i);
+			return 0;
+		}
+
+	private:
+		friend histogram;
+
+		std::vector<std::uint64_t> counts = std::vector<std::uint64_t>(num_buckets);
+		std::uint64_t total = 0;
+	};
+
+private:
+	using buckets = std::array<std::uint64_t, num_buckets>;
+	using slots = collect<buckets, none, histogram>;
+
+	// Moves the threads counts to 'expired' when the thread exits
+	struct thread_slot final {
+		thread_slot() noexcept : data(slots::local()) {}
+
+		~thread_slot() {
+			expiring.expire([this] {
+				for (std::size_t i = 0; i < num_buckets; i++) {
+					std::atomic_ref<std::uint64_t> count(data[i]);
+					if (std::uint64_t const c = count.load(std::memory_order_relaxed); c != 0) {
+						expired[i].fetch_add(c, std::memory_order_relaxed);
+						count.store(0, std::memory_order_relaxed);
+					}
+				}
+			});
+		}
+
+		buckets& data;
+	};
+
+	static buckets& local() noexcept {
+		thread_local thread_slot slot{};
+		return slot.data;
+	}
+
+	// Adds 'counts' into the snapshot
+	static snapshot merge(snapshot&& s, buckets const& counts) noexcept {
+		for (std::size_t i = 0; i < num_buckets; i++) {
+			s.counts[i] += counts[i];
+			s.total += counts[i];
+		}
+		return std::move(s);
+	}
+
+	// The counts from expired threads
+	inline static std::array<std::atomic<std::uint64_t>, num_buckets> expired{};
+
+	// Used by 'read' to detect threads that exited while it was merging
+	inline static detail::expiring_threads expiring;
+
+public:
+	// Counts 'value' once
+	static void record(std::uint64_t value) noexcept {
+		record(value, 1);
+	}
+
+	// Counts 'value' 'count' times
+	static void record(std::uint64_t value, std::uint64_t count) noexcept {
+		std::atomic_ref<std::uint64_t> c(local()[bucket_of(value)]);
+		c.store(c.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	}
+
+	// Returns the merged counts of all the threads, including the ones from expired threads
+	[[nodiscard]] static snapshot read() {
+		return expiring.read([] {
+			snapshot s;
+			for (std::size_t i = 0; i < num_buckets; i++) {
+				s.counts[i] = expired[i].load(std::memory_order_relaxed);
+				s.total += s.counts[i];
+			}
+			return slots::reduce_snapshot(std::move(s), merge);
+		});
+	}
+};
+
+template <unsigned sub_bucket_bits = 5, auto U = [] {}>
+using unique_histogram = histogram<sub_bucket_bits, decltype(U)>;
+
+} // namespace tls
+
+#endif // !TLS_HISTOGRAM_H
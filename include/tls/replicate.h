@@ -1,189 +1,504 @@
-﻿#ifndef TLS_REPLICATE_H
-#define TLS_REPLICATE_H
-
-#include <shared_mutex>
-
-namespace tls {
-// This class can be used to replicate data from one writer thread to other reader threads.
-// Data written to the replicator is copied to all threads that read from it, with minimal use of locking.
-// The writer thread locks when data is written. Reader threads only lock when
-// data is modified and needs to be updated.
-// When data has not been modified it reads from its local copy.
-template <class T, class UnusedDifferentiator = struct default_replicate_version>
-class replicate {
-	// This struct manages the per-thread data
-	struct thread_data {
-		// The thread is dead, so remove references to it from all instances
-		~thread_data() {
-			if (nullptr != replicator) {
-				replicator->remove_thread(this);
-			}
-		}
-
-		void remove(replicate *repl) noexcept {
-			if (replicator == repl) {
-				data_copy = {};
-				replicator = nullptr;
-				next = nullptr;
-				invalidated = true;
-			}
-		}
-
-		// Marks the data as out-of-date
-		void invalidate() {
-			invalidated = true;
-		}
-
-		// Returns the local data
-		T const &read(replicate *repl) {
-			maybe_update_data(repl);
-			return data_copy;
-		}
-
-		// Pass the local data to a user function
-		template <class Fn>
-		auto read(replicate *repl, Fn&& f) {
-			maybe_update_data(repl);
-
-			// Only pass const-ref data to the function
-			T const &const_data = data_copy;
-			return f(const_data);
-		}
-
-		// Sets a copy of the data for an repl
-		void set_data(T const &t) {
-			data_copy = t;
-		}
-
-		// Resets the instances replicator to null
-		void reset_owner() {
-			replicator = nullptr;
-		}
-
-		void set_next(thread_data *ia) noexcept {
-			next = ia;
-		}
-		thread_data *get_next() noexcept {
-			return next;
-		}
-		thread_data const *get_next() const noexcept {
-			return next;
-		}
-
-		// Check to see if the data needs updating
-		void maybe_update_data(replicate *repl) {
-			// Ensure this thread_data instance is initialized
-			if (replicator == nullptr) {
-				// this is the first time it has been accessed (ie. new thread)
-				repl->init_thread(this);
-				return;
-			}
-
-			// Update local data if the main data has changed
-			if (invalidated) {
-				invalidated = false;
-
-				std::shared_lock sl(replicator->mtx);
-				data_copy = replicator->data;
-			}
-		}
-
-		T data_copy{};
-		replicate<T> *replicator{nullptr};
-		thread_data *next{nullptr};
-		bool invalidated{true};
-	};
-
-	// Store a thread_data in this repl
-	void init_thread(thread_data *t) {
-		std::unique_lock ul(mtx);
-
-		t->replicator = this;
-		t->data_copy = data;
-		t->invalidated = false;
-		t->set_next(head);
-		head = t;
-	}
-
-	// Removes a thread. Happens when they expire
-	void remove_thread(thread_data *t) {
-		std::unique_lock ul(mtx);
-
-		// Remove the thread from the linked list
-		if (head == t) {
-			head = t->get_next();
-		} else {
-			auto curr = head;
-			while (curr->get_next() != nullptr) {
-				if (curr->get_next() == t) {
-					curr->set_next(t->get_next());
-					return;
-				} else {
-					curr = curr->get_next();
-				}
-			}
-		}
-	}
-
-	// Get the thread_data repl for the current thread
-	thread_data &local() {
-		thread_local thread_data inst{};
-		return inst;
-	}
-
-public:
-	replicate(T &&t) : data(std::forward<T>(t)) {}
-	replicate(T const &t) : data(t) {}
-
-	~replicate() {
-		std::unique_lock ul(mtx);
-		for (auto *thread = head; thread != nullptr;) {
-			auto next = thread->get_next();
-			thread->remove(this);
-			thread = next;
-		}
-	}
-
-	// Read the threads copy of data
-	T const &read() {
-		return local().read(this);
-	}
-
-	// Pass the threads copy of data to a user function
-	template <class Fn>
-	auto read(Fn&& f) {
-		return local().read(this, std::forward<Fn>(f));
-	}
-
-	// Set the master data
-	void write(T const &t) {
-		// Take a unique lock on the data so no other thread can modify it
-		std::unique_lock ul(mtx);
-
-		// Write the data
-		data = t;
-
-		// Notify all threads that the data has changed
-		for (auto *thread = head; thread != nullptr; thread = thread->get_next()) {
-			thread->invalidate();
-		}
-	}
-
-	// Get the master data
-	T const &base_data() const {
-		return data;
-	}
-
-private:
-	// The main data that is replicated to threads
-	T data;
-
-	// The head of threads that access this replicator. Changes to 'data'
-	// will be replicated threads reachable from here
-	inline static thread_data *head{};
-
-	// Mutex to serialize access to 'data' when it is modified
-	inline static std::shared_mutex mtx;
-};
-} // namespace tls
-#endif // !TLS_REPLICATE_H
+﻿#ifndef TLS_REPLICATE_H
+#define TLS_REPLICATE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "detail/cpu.h"
+#include "detail/instance_table.h"
+#include "detail/no_unique_address.h"
+#include "detail/shared_mutex.h"
+
+namespace tls {
+// Pass this type to the 'Policy' argument of 'tls::replicate' to give each
+// reader thread its own copy of the data. This is the default.
+struct per_thread_copy {};
+
+// Pass this type to the 'Policy' argument of 'tls::replicate' to have reader threads
+// share one immutable, reference counted snapshot of the data instead of each holding a copy.
+// Writes publish a new snapshot, and readers swap their pointer to it on their next read.
+struct shared_snapshot {};
+
+// Like 'shared_snapshot', but with one snapshot per NUMA node, so reader threads read memory
+// that is local to the node they run on. The snapshot for a node is copied by the first
+// reader on that node after a write, so on systems that allocate memory on first touch
+// the copy lives on that node. The writers node uses the written snapshot directly.
+struct per_node_snapshot {};
+
+// Pass this type to the 'Policy' argument of 'tls::replicate' to let writers send small
+// patches with 'write_delta' instead of the full data. Readers keep their own copy of the data,
+// like with 'per_thread_copy', and apply the patches they have missed to it. The last 'max_patches'
+// patches are kept, and readers that have missed more than that copy the full data instead.
+// A patch is applied by calling 'patch(data)'.
+template <class Patch, std::size_t max_patches = 64>
+class patch_log {
+	static_assert(max_patches > 0, "the log must be able to hold at least one patch");
+
+public:
+	using patch_type = Patch;
+
+	// Adds the patch that produced 'version' from the previous version
+	void add(std::uint64_t version, Patch const& patch) {
+		patches[version % max_patches] = patch;
+		if (version - first > max_patches)
+			first = version - max_patches;
+	}
+
+	// Discards all patches. 'version' is the version of the data that has been written in full
+	void reset(std::uint64_t version) noexcept {
+		first = version;
+	}
+
+	// Updates 'data' from version 'from' to version 'to' by applying the patches in between.
+	// Returns false if some of those patches are no longer in the log.
+	template <class T>
+	bool apply(T& data, std::uint64_t from, std::uint64_t to) const {
+		if (from < first)
+			return false;
+
+		for (std::uint64_t version = from + 1; version <= to; version++)
+			std::invoke(*patches[version % max_patches], data);
+		return true;
+	}
+
+private:
+	std::array<std::optional<Patch>, max_patches> patches{};
+
+	// The log holds the patches for the versions after this one
+	std::uint64_t first = 0;
+};
+
+namespace detail {
+// True for the policies of 'tls::replicate'
+template <class P>
+constexpr bool is_replicate_policy = std::same_as<P, per_thread_copy> || std::same_as<P, shared_snapshot> || std::same_as<P, per_node_snapshot>;
+template <class Patch, std::size_t max_patches>
+constexpr bool is_replicate_policy<patch_log<Patch, max_patches>> = true;
+} // namespace detail
+
+// This class can be used to replicate data from one writer thread to other reader threads.
+// Data written to the replicator is copied to all threads that read from it, with minimal use of locking.
+// The writer thread locks when data is written. Reader threads only lock when
+// data is modified and needs to be updated.
+// When data has not been modified it reads from its local copy.
+// Each write bumps a version number, which readers compare to the version of their local data,
+// so writes don't have to visit the readers, and a read of unmodified data is a single relaxed load.
+// Threads can also sleep until a new version is written, with 'wait_for_update' or 'co_await updated(..)'.
+// Each instance has its own readers and lock, so writes to one instance don't affect readers of another.
+// Reader threads find their data in a thread-local table, indexed by the instance.
+// 'UnusedDifferentiator' is kept for compatibility, and is no longer needed to separate instances.
+template <class T, class UnusedDifferentiator = struct default_replicate_version, class Policy = per_thread_copy>
+class replicate {
+	// Catch a policy passed in place of the differentiator, like in 'replicate<T, shared_snapshot>'
+	static_assert(!detail::is_replicate_policy<UnusedDifferentiator>, "the policy is the third argument, as in 'replicate<T, struct tag, Policy>'");
+
+	static constexpr bool is_per_node = std::same_as<Policy, per_node_snapshot>;
+	static constexpr bool is_shared = std::same_as<Policy, shared_snapshot> || is_per_node;
+	static constexpr bool has_patches = requires { typename Policy::patch_type; };
+
+	// The data held by each reader thread
+	using local_data = std::conditional_t<is_shared, std::shared_ptr<T const>, T>;
+
+	// The main data
+	using master_data = std::conditional_t<is_shared, std::shared_ptr<T const>, T>;
+
+	// The data of one reader thread in one instance
+	struct thread_data {
+		T const &get() const noexcept {
+			if constexpr (is_shared)
+				return *data;
+			else
+				return data;
+		}
+
+		local_data data{};
+		thread_data *prev{nullptr};
+		thread_data *next{nullptr};
+		std::uint64_t version{0};
+	};
+
+	using table = detail::instance_table<replicate, thread_data>;
+	friend table;
+
+	// Creates the calling threads data in this instance
+	thread_data &init_thread() {
+		thread_data *t = new thread_data{};
+		{
+			std::unique_lock ul(mtx);
+			copy_data(t);
+			t->next = head;
+			if (head != nullptr)
+				head->prev = t;
+			head = t;
+		}
+		table::bind(handle, t);
+		return *t;
+	}
+
+	// Brings a threads local data up to date
+	void update_thread(thread_data *t) {
+		std::shared_lock sl(mtx);
+
+		if constexpr (has_patches) {
+			std::uint64_t const current = data_version.load(std::memory_order_relaxed);
+			if (policy.apply(t->data, t->version, current)) {
+				t->version = current;
+				return;
+			}
+		}
+
+		copy_data(t);
+	}
+
+	// Copies the current data to a thread. For shared snapshots this only copies the pointer.
+	void copy_data(thread_data *t) {
+		t->version = data_version.load(std::memory_order_relaxed);
+
+		if constexpr (is_per_node) {
+			unsigned const node = detail::current_numa_node();
+
+			// Readers can get here at the same time under the shared lock
+			std::scoped_lock sl(node_mtx);
+			if (node >= node_data.size())
+				node_data.resize(node + 1);
+
+			std::shared_ptr<T const> &snapshot = node_data[node];
+			if (!snapshot)
+				snapshot = std::make_shared<T const>(*data);
+			t->data = snapshot;
+		} else {
+			t->data = data;
+		}
+	}
+
+	// Removes the data of an exiting thread
+	void release_slot(thread_data *t) {
+		{
+			std::unique_lock ul(mtx);
+			if (t->prev != nullptr)
+				t->prev->next = t->next;
+			else
+				head = t->next;
+			if (t->next != nullptr)
+				t->next->prev = t->prev;
+		}
+		delete t;
+	}
+
+	// Returns the calling threads data, and brings it up to date
+	thread_data &local() {
+		thread_data *t = table::find(handle);
+		if (t == nullptr)
+			return init_thread();
+
+		// Update local data if the main data has changed
+		if (t->version != data_version.load(std::memory_order_relaxed))
+			update_thread(t);
+		return *t;
+	}
+
+	// Publishes new data
+	template <class U>
+	void publish(U &&u) {
+		if constexpr (is_shared) {
+			// Build the snapshot before taking the lock. The lock is only held to swap the pointer,
+			// and the old snapshot is freed when the last reader lets go of it.
+			std::shared_ptr<T const> snapshot = std::make_shared<T const>(std::forward<U>(u));
+
+			{
+				std::unique_lock ul(mtx);
+				data.swap(snapshot);
+				data_version.fetch_add(1, std::memory_order_release);
+
+				if constexpr (is_per_node)
+					reset_node_data();
+			}
+		} else {
+			std::unique_lock ul(mtx);
+			data = std::forward<U>(u);
+			std::uint64_t const version = data_version.fetch_add(1, std::memory_order_release) + 1;
+
+			if constexpr (has_patches)
+				policy.reset(version);
+		}
+
+		notify_waiters();
+	}
+
+	// Returns the data a batch modifies. Shared snapshots can't be modified, so batches work on a copy.
+	std::conditional_t<is_shared, T, T &> editable_data() {
+		if constexpr (is_shared)
+			return *data;
+		else
+			return data;
+	}
+
+	// Publishes the data modified by a batch. Called with 'mtx' locked.
+	void commit(T &edit) {
+		if constexpr (is_shared) {
+			data = std::make_shared<T const>(std::move(edit));
+			if constexpr (is_per_node)
+				reset_node_data();
+		}
+
+		std::uint64_t const version = data_version.fetch_add(1, std::memory_order_release) + 1;
+
+		// The modifications are unknown to the patch log
+		if constexpr (has_patches)
+			policy.reset(version);
+	}
+
+	// Wakes up the threads waiting for a new version, and resumes the waiting coroutines
+	void notify_waiters() {
+		data_version.notify_all();
+
+		std::vector<std::coroutine_handle<>> resume;
+		{
+			std::scoped_lock sl(wait_mtx);
+			resume.swap(awaiting);
+		}
+		wait_cv.notify_all();
+
+		for (std::coroutine_handle<> h : resume)
+			h.resume();
+	}
+
+	// The awaiter returned by 'updated'
+	struct update_awaiter {
+		replicate *repl;
+		std::uint64_t last_version;
+
+		bool await_ready() const noexcept {
+			return repl->version() != last_version;
+		}
+
+		bool await_suspend(std::coroutine_handle<> h) {
+			// Checked under the lock, so a write can't happen between the check and the suspend
+			std::scoped_lock sl(repl->wait_mtx);
+			if (repl->version() != last_version)
+				return false;
+			repl->awaiting.push_back(h);
+			return true;
+		}
+
+		std::uint64_t await_resume() const noexcept {
+			return repl->version();
+		}
+	};
+
+	// Drops the snapshots of the old data, and lets readers on the
+	// writers node use the new snapshot, which was built on that node
+	void reset_node_data()
+		requires(is_per_node)
+	{
+		unsigned const node = detail::current_numa_node();
+		std::scoped_lock sl(node_mtx);
+		node_data.assign(std::max<std::size_t>(node_data.size(), node + 1), nullptr);
+		node_data[node] = data;
+	}
+
+	template <class U>
+	static master_data make_data(U &&u) {
+		if constexpr (is_shared)
+			return std::make_shared<T const>(std::forward<U>(u));
+		else
+			return std::forward<U>(u);
+	}
+
+public:
+	// Collects modifications of the master data, and publishes all of them as one new version
+	// when it is destroyed, so readers only update once. The write lock is held for the
+	// lifetime of the batch, so the thread holding it must not read from the replicator.
+	class batch {
+	public:
+		explicit batch(replicate &r) : repl(r), lock(r.mtx), edit(r.editable_data()) {}
+
+		batch(batch const &) = delete;
+		batch &operator=(batch const &) = delete;
+
+		~batch() {
+			repl.commit(edit);
+			lock.unlock();
+			repl.notify_waiters();
+		}
+
+		// The data being modified
+		T &data() noexcept {
+			return edit;
+		}
+
+		void write(T const &t) {
+			edit = t;
+		}
+		void write(T &&t) {
+			edit = std::move(t);
+		}
+
+		// Modify the data with 'fn(T&)'
+		template <class Fn>
+		void modify(Fn &&fn) {
+			std::invoke(std::forward<Fn>(fn), edit);
+		}
+
+	private:
+		replicate &repl;
+		std::unique_lock<detail::shared_mutex> lock;
+		std::conditional_t<is_shared, T, T &> edit;
+	};
+
+	replicate(T &&t) : data(make_data(std::move(t))) {
+		if constexpr (is_per_node)
+			reset_node_data();
+	}
+	replicate(T const &t) : data(make_data(t)) {
+		if constexpr (is_per_node)
+			reset_node_data();
+	}
+
+	~replicate() {
+		// No thread can release its data after this
+		table::remove(handle);
+
+		for (thread_data *t = head; t != nullptr;) {
+			thread_data *next = t->next;
+			delete t;
+			t = next;
+		}
+	}
+
+	replicate(replicate const &) = delete;
+	replicate &operator=(replicate const &) = delete;
+
+	// Read the threads copy of data
+	T const &read() {
+		return local().get();
+	}
+
+	// Pass the threads copy of data to a user function
+	template <class Fn>
+	auto read(Fn&& f) {
+		// Only pass const-ref data to the function
+		T const &const_data = local().get();
+		return f(const_data);
+	}
+
+	// Set the master data
+	void write(T const &t) {
+		publish(t);
+	}
+	void write(T &&t) {
+		publish(std::move(t));
+	}
+
+	// Patch the master data. Readers apply the same patch to their copy of the data.
+	template <class P = Policy>
+	void write_delta(typename P::patch_type const &patch)
+		requires(has_patches)
+	{
+		{
+			std::unique_lock ul(mtx);
+			std::invoke(patch, data);
+			std::uint64_t const version = data_version.fetch_add(1, std::memory_order_release) + 1;
+			policy.add(version, patch);
+		}
+
+		notify_waiters();
+	}
+
+	// Modify the master data in place with 'fn(T&)', while holding the write lock,
+	// so concurrent writers don't lose each others modifications.
+	// With shared snapshots the modification is done on a copy of the data.
+	template <class Fn>
+	void modify(Fn &&fn) {
+		batch b(*this);
+		b.modify(std::forward<Fn>(fn));
+	}
+
+	// Starts a batch of writes. See 'batch'.
+	[[nodiscard]] batch batch_write() {
+		return batch{*this};
+	}
+
+	// Get the master data
+	T const &base_data() const {
+		if constexpr (is_shared)
+			return *data;
+		else
+			return data;
+	}
+
+	// Returns the version of the master data. It changes on every write.
+	std::uint64_t version() const noexcept {
+		return data_version.load(std::memory_order_acquire);
+	}
+
+	// Blocks until the version of the master data is different from 'last_version',
+	// and returns the new version
+	std::uint64_t wait_for_update(std::uint64_t last_version) const {
+		data_version.wait(last_version, std::memory_order_acquire);
+		return version();
+	}
+
+	// Like 'wait_for_update', but gives up after 'timeout'.
+	// Returns 'last_version' if no new version was written in time.
+	template <class Rep, class Period>
+	std::uint64_t wait_for_update(std::uint64_t last_version, std::chrono::duration<Rep, Period> timeout) const {
+		std::unique_lock ul(wait_mtx);
+		wait_cv.wait_for(ul, timeout, [&] { return version() != last_version; });
+		return version();
+	}
+
+	// Returns an awaitable that suspends a coroutine until the version of the master data
+	// is different from 'last_version'. The coroutine is resumed on the writing thread,
+	// after the write has finished, and 'co_await' returns the new version.
+	// Coroutines that are still waiting when the replicator is destroyed are never resumed.
+	[[nodiscard]] update_awaiter updated(std::uint64_t last_version) {
+		return {this, last_version};
+	}
+
+private:
+	// The main data that is replicated to threads
+	master_data data;
+
+	// The version of 'data'. Reader threads compare it to the version of their local data.
+	std::atomic<std::uint64_t> data_version{1};
+
+	// Holds the state of the policy, if it has any
+	TLS_NO_UNIQUE_ADDRESS Policy policy{};
+
+	// The snapshots for each NUMA node, used by 'per_node_snapshot'
+	struct no_node_data {};
+	TLS_NO_UNIQUE_ADDRESS std::conditional_t<is_per_node, std::vector<std::shared_ptr<T const>>, no_node_data> node_data{};
+	TLS_NO_UNIQUE_ADDRESS std::conditional_t<is_per_node, std::mutex, no_node_data> node_mtx{};
+
+	// Used to wake up readers waiting for a new version with a timeout, and waiting coroutines.
+	// Waiting does not modify the instance, so they can be used from const functions.
+	mutable std::mutex wait_mtx;
+	mutable std::condition_variable wait_cv;
+	std::vector<std::coroutine_handle<>> awaiting;
+
+	// This instances index in the threads tables
+	typename table::handle const handle = table::add(this);
+
+	// The threads that read from this replicator
+	thread_data *head{};
+
+	// Mutex to serialize access to 'data' and the threads when they are modified
+	detail::shared_mutex mtx{"tls::replicate"};
+};
+} // namespace tls
+#endif // !TLS_REPLICATE_H
@@ -1,15 +1,25 @@
-#ifndef TLS_SPLIT_H
-#define TLS_SPLIT_H
-
-#include "collect.h"
-
-namespace tls {
-template <typename T, typename UnusedDifferentiaterType = void>
-using split = collect<T, none, UnusedDifferentiaterType>;
-
-template <typename T, auto U = [] {}>
-using unique_split = split<T, decltype(U)>;
-
-} // namespace tls
-
-#endif // !TLS_SPLIT_H
+#ifndef TLS_SPLIT_H
+#define TLS_SPLIT_H
+
+#include "collect.h"
+#include "dynamic_collect.h"
+
+namespace tls {
+template <typename T, typename UnusedDifferentiaterType = void>
+using split = collect<T, none, UnusedDifferentiaterType>;
+
+template <typename T, auto U = [] {}>
+using unique_split = split<T, decltype(U)>;
+
+// A split where new threads adopt the data left behind by expired threads,
+// instead of starting from a default constructed T
+template <typename T, typename UnusedDifferentiaterType = void>
+using recycled_split = collect<T, none, UnusedDifferentiaterType, 64UL, recycled_slots>;
+
+// A split where each instance has its own thread-local data
+template <typename T>
+using dynamic_split = dynamic_collect<T, none>;
+
+} // namespace tls
+
+#endif // !TLS_SPLIT_H
@@ -0,0 +1,302 @@
+// Stress test for tls::collect, tls::recycled_split and tls::replicate. Each scenario runs
+// worker threads that are replaced after a number of operations, while another thread gathers
+// or writes, and checks that no data is lost or torn. The latency of 'local()' and 'read()'
+// and the wait and hold times of the librarys shared mutexes are reported, and the run fails
+// if the throughput or the p99 latency is worse than the given thresholds.
+//
+// Options, all optional:
+//   --threads=N           worker threads, 4 by default
+//   --seconds=S           duration of each scenario, 1 by default
+//   --churn=N             operations before a worker thread is replaced, 0 to never replace them
+//   --interval-us=N       microseconds between gathers and writes
+//   --min-ops-per-sec=N   fail if a scenarios throughput is below N
+//   --max-p99-ns=N        fail if a scenarios p99 latency is above N nanoseconds
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <tls/collect.h>
+#include <tls/histogram.h>
+#include <tls/replicate.h>
+#include <tls/split.h>
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+	unsigned threads = 4;
+	double seconds = 1.0;
+	std::uint64_t churn = 10'000;
+	std::uint64_t interval_us = 100;
+	double min_ops_per_sec = 0;
+	std::uint64_t max_p99_ns = 0;
+};
+
+// The results of a scenario
+struct result {
+	char const* name;
+	std::uint64_t ops;
+	double seconds;
+	std::uint64_t p50_ns;
+	std::uint64_t p99_ns;
+	bool valid;
+};
+
+//
+// Lock instrumentation
+//
+using lock_histogram = tls::histogram<5, struct lock_times>;
+using wait_histogram = tls::histogram<5, struct lock_waits>;
+
+static void record_lock(tls::lock_event const& e) noexcept {
+	wait_histogram::record(static_cast<std::uint64_t>(e.wait.count()));
+	lock_histogram::record(static_cast<std::uint64_t>(e.hold.count()));
+}
+
+//
+// Runs 'work' on 'threads' lanes for 'seconds'. Each lane runs 'work' on a new thread that is
+// replaced after 'churn' operations. 'work(stop, budget)' returns the number of operations it did.
+//
+template <typename Work>
+static std::uint64_t run_workers(options const& opt, std::atomic_bool const& stop, Work const& work) {
+	std::atomic<std::uint64_t> total_ops{0};
+	std::vector<std::jthread> lanes;
+	for (unsigned i = 0; i < opt.threads; i++) {
+		lanes.emplace_back([&] {
+			while (!stop) {
+				std::thread([&] {
+					total_ops += work(stop, opt.churn == 0 ? UINT64_MAX : opt.churn);
+				}).join();
+			}
+		});
+	}
+	lanes.clear();
+	return total_ops;
+}
+
+// Records the time of one in 16 calls of 'fn' in 'Histogram'
+template <typename Histogram, typename Fn>
+static void sample(std::uint64_t op, Fn&& fn) {
+	if (op % 16 != 0) {
+		fn();
+		return;
+	}
+
+	auto const start = clock_type::now();
+	fn();
+	Histogram::record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count()));
+}
+
+//
+// collect: workers add to their data while another thread gathers it
+//
+
+// A counter where moving drains the source and assigning adds to the target, so a gather that
+// runs while the owner is adding does not lose or duplicate counts
+struct drain_cell {
+	drain_cell() = default;
+	drain_cell(drain_cell&& other) noexcept : value(other.value.exchange(0)) {}
+	drain_cell& operator=(drain_cell&& other) noexcept {
+		value.fetch_add(other.value.exchange(0));
+		return *this;
+	}
+
+	std::atomic<std::uint64_t> value{0};
+};
+
+static result stress_collect(options const& opt) {
+	using collector = tls::collect<drain_cell, std::vector, struct stress_collect>;
+	using latencies = tls::histogram<5, struct collect_latencies>;
+
+	std::atomic_bool stop = false;
+	std::uint64_t gathered = 0;
+	std::jthread gatherer([&] {
+		while (!stop) {
+			for (drain_cell const& c : collector::gather())
+				gathered += c.value.load();
+			std::this_thread::sleep_for(std::chrono::microseconds(opt.interval_us));
+		}
+	});
+
+	auto const start = clock_type::now();
+	std::jthread timer([&] {
+		std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+		stop = true;
+	});
+
+	std::uint64_t const ops = run_workers(opt, stop, [](std::atomic_bool const& stopped, std::uint64_t budget) {
+		std::uint64_t n = 0;
+		for (; n < budget && !stopped; n++) {
+			sample<latencies>(n, [] { collector::local().value.fetch_add(1, std::memory_order_relaxed); });
+		}
+		return n;
+	});
+	double const seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+	timer.join();
+	gatherer.join();
+	for (drain_cell const& c : collector::gather())
+		gathered += c.value.load();
+
+	auto const s = latencies::read();
+	return {"collect local() + gather()", ops, seconds, s.percentile(50), s.percentile(99), gathered == ops};
+}
+
+//
+// recycled_split: workers fill their scratch buffer, which must never be shared with another thread
+//
+static result stress_split(options const& opt) {
+	using splitter = tls::recycled_split<std::vector<std::uint64_t>, struct stress_split>;
+	using latencies = tls::histogram<5, struct split_latencies>;
+
+	std::atomic_bool stop = false;
+	std::atomic_bool valid = true;
+	std::atomic<std::uint64_t> next_owner{1};
+
+	auto const start = clock_type::now();
+	std::jthread timer([&] {
+		std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+		stop = true;
+	});
+
+	std::uint64_t const ops = run_workers(opt, stop, [&](std::atomic_bool const& stopped, std::uint64_t budget) {
+		std::uint64_t const owner = next_owner++;
+		std::vector<std::uint64_t>& buffer = splitter::local();
+		buffer.clear();
+
+		std::uint64_t n = 0;
+		for (; n < budget && !stopped; n++) {
+			sample<latencies>(n, [&] {
+				std::vector<std::uint64_t>& b = splitter::local();
+				if (b.size() == 1024)
+					b.clear();
+				b.push_back(owner);
+			});
+		}
+
+		for (std::uint64_t const v : buffer)
+			if (v != owner)
+				valid = false;
+		return n;
+	});
+	double const seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+	auto const s = latencies::read();
+	return {"recycled_split local()", ops, seconds, s.percentile(50), s.percentile(99), valid.load()};
+}
+
+//
+// replicate: workers read while another thread writes, and check that no read is torn
+//
+static result stress_replicate(options const& opt) {
+	struct pair {
+		std::uint64_t a = 0;
+		std::uint64_t b = 0;
+	};
+	using latencies = tls::histogram<5, struct replicate_latencies>;
+
+	tls::replicate<pair> repl{pair{}};
+	std::atomic_bool stop = false;
+	std::atomic_bool valid = true;
+
+	std::jthread writer([&] {
+		for (std::uint64_t i = 1; !stop; i++) {
+			repl.write(pair{i, i});
+			std::this_thread::sleep_for(std::chrono::microseconds(opt.interval_us));
+		}
+	});
+
+	auto const start = clock_type::now();
+	std::jthread timer([&] {
+		std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+		stop = true;
+	});
+
+	std::uint64_t const ops = run_workers(opt, stop, [&](std::atomic_bool const& stopped, std::uint64_t budget) {
+		std::uint64_t last = 0;
+		std::uint64_t n = 0;
+		for (; n < budget && !stopped; n++) {
+			sample<latencies>(n, [&] {
+				repl.read([&](pair const& p) {
+					if (p.a != p.b || p.a < last)
+						valid = false;
+					last = p.a;
+				});
+			});
+		}
+		return n;
+	});
+	double const seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+	timer.join();
+	writer.join();
+
+	auto const s = latencies::read();
+	return {"replicate read() + write()", ops, seconds, s.percentile(50), s.percentile(99), valid.load()};
+}
+
+static bool parse(std::string_view arg, std::string_view name, auto& value) {
+	if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=')
+		return false;
+	std::string_view const text = arg.substr(name.size() + 1);
+	if constexpr (std::is_floating_point_v<std::remove_reference_t<decltype(value)>>)
+		value = std::strtod(std::string(text).c_str(), nullptr);
+	else
+		std::from_chars(text.data(), text.data() + text.size(), value);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	options opt;
+	for (int i = 1; i < argc; i++) {
+		std::string_view const arg = argv[i];
+		if (!(parse(arg, "--threads", opt.threads) || parse(arg, "--seconds", opt.seconds) || parse(arg, "--churn", opt.churn) ||
+			  parse(arg, "--interval-us", opt.interval_us) || parse(arg, "--min-ops-per-sec", opt.min_ops_per_sec) ||
+			  parse(arg, "--max-p99-ns", opt.max_p99_ns))) {
+			std::fprintf(stderr, "unknown option '%s'\n", argv[i]);
+			return 2;
+		}
+	}
+
+	tls::set_lock_hook(record_lock);
+
+	std::printf("%u threads, %.2fs per scenario, churn every %llu ops, gather/write every %llu us\n\n", opt.threads, opt.seconds,
+				static_cast<unsigned long long>(opt.churn), static_cast<unsigned long long>(opt.interval_us));
+	std::printf("%-28s %14s %10s %10s  %s\n", "scenario", "ops/s", "p50 ns", "p99 ns", "result");
+
+	bool passed = true;
+	for (auto const scenario : {stress_collect, stress_split, stress_replicate}) {
+		result const r = scenario(opt);
+		double const ops_per_sec = static_cast<double>(r.ops) / r.seconds;
+
+		char const* verdict = "ok";
+		if (!r.valid)
+			verdict = "FAILED: data was lost or torn";
+		else if (ops_per_sec < opt.min_ops_per_sec)
+			verdict = "FAILED: throughput regressed";
+		else if (opt.max_p99_ns != 0 && r.p99_ns > opt.max_p99_ns)
+			verdict = "FAILED: p99 latency regressed";
+		passed = passed && std::strcmp(verdict, "ok") == 0;
+
+		std::printf("%-28s %14.0f %10llu %10llu  %s\n", r.name, ops_per_sec, static_cast<unsigned long long>(r.p50_ns),
+					static_cast<unsigned long long>(r.p99_ns), verdict);
+	}
+
+	tls::set_lock_hook(nullptr);
+	auto const waits = wait_histogram::read();
+	auto const holds = lock_histogram::read();
+	std::printf("\n%llu shared_mutex locks: wait p50 %llu ns, p99 %llu ns, max %llu ns; hold p50 %llu ns, p99 %llu ns, max %llu ns\n",
+				static_cast<unsigned long long>(waits.count()), static_cast<unsigned long long>(waits.percentile(50)),
+				static_cast<unsigned long long>(waits.percentile(99)), static_cast<unsigned long long>(waits.max()),
+				static_cast<unsigned long long>(holds.percentile(50)), static_cast<unsigned long long>(holds.percentile(99)),
+				static_cast<unsigned long long>(holds.max()));
+
+	return passed ? 0 : 1;
+}
@@ -1,46 +1,388 @@
-#include "../catch.hpp"
-#include <execution>
-#include <tls/cache.h>
-
-TEST_CASE("tls::cache specification") {
-	SECTION("takes up a cacheline in size") {
-		constexpr tls::cache<int, int, 0> cache1;
-		REQUIRE(sizeof(cache1) <= 64UL);
-
-		constexpr tls::cache<short, int, 0> cache2;
-		REQUIRE(sizeof(cache2) <= 64UL);
-
-		struct local {
-			char s[3];
-		};
-		constexpr tls::cache<short, local, 0> cache3;
-		REQUIRE(sizeof(cache3) <= 64UL);
-
-		struct local2 {
-			char s[16];
-		};
-		constexpr tls::cache<short, local2, 0, 128UL> cache4; // 64b cache-line will fail
-		REQUIRE(sizeof(cache4) <= 128UL);
-	}
-
-	SECTION("caching works") {
-		tls::cache<int, int, -1> cache;
-
-		int calc_count = 0;
-		auto const calc_val = [&calc_count](int key) {
-			calc_count += 1;
-			return key + 16;
-		};
-
-		for (int i=0; i<8; i++) {
-			cache.get_or(i, calc_val);
-		}
-		REQUIRE(calc_count == 8);
-
-		// values should be cached, so calc_count should not increase
-		for (int i=0; i<8; i++) {
-			cache.get_or(i, calc_val);
-		}
-		REQUIRE(calc_count == 8);
-	}
-}
+#include "../catch.hpp"
+#include <cstdint>
+#include <execution>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <tls/cache.h>
+#include <tls/cache_stats_collected.h>
+
+TEST_CASE("tls::cache specification") {
+	SECTION("takes up a cacheline in size") {
+		constexpr tls::cache<int, int, 0> cache1;
+		REQUIRE(sizeof(cache1) <= 64UL);
+
+		constexpr tls::cache<short, int, 0> cache2;
+		REQUIRE(sizeof(cache2) <= 64UL);
+
+		struct local {
+			char s[3];
+		};
+		constexpr tls::cache<short, local, 0> cache3;
+		REQUIRE(sizeof(cache3) <= 64UL);
+
+		struct local2 {
+			char s[16];
+		};
+		constexpr tls::cache<short, local2, 0, 128UL> cache4; // 64b cache-line will fail
+		REQUIRE(sizeof(cache4) <= 128UL);
+	}
+
+	SECTION("caching works") {
+		tls::cache<int, int, -1> cache;
+
+		int calc_count = 0;
+		auto const calc_val = [&calc_count](int key) {
+			calc_count += 1;
+			return key + 16;
+		};
+
+		for (int i=0; i<8; i++) {
+			cache.get_or(i, calc_val);
+		}
+		REQUIRE(calc_count == 8);
+
+		// values should be cached, so calc_count should not increase
+		for (int i=0; i<8; i++) {
+			cache.get_or(i, calc_val);
+		}
+		REQUIRE(calc_count == 8);
+	}
+
+	SECTION("vectorized probes find the same keys") {
+		// Compares the probe with a plain loop
+		auto const check = [](auto key_type) {
+			using Key = decltype(key_type);
+			Key keys[37]{};
+			for (int i = 0; i < 37; i++)
+				keys[i] = static_cast<Key>(i % 11);
+
+			for (int k = 0; k < 12; k++) {
+				std::uint64_t expected = 0;
+				for (int i = 0; i < 37; i++)
+					if (keys[i] == static_cast<Key>(k))
+						expected |= std::uint64_t{1} << i;
+
+				std::size_t const first = (expected == 0) ? 37 : static_cast<std::size_t>(std::countr_zero(expected));
+				REQUIRE(tls::detail::match_mask(keys, static_cast<Key>(k)) == expected);
+				REQUIRE(tls::detail::find_key(keys, static_cast<Key>(k)) == first);
+			}
+		};
+		check(std::int8_t{});
+		check(std::uint16_t{});
+		check(int{});
+		check(std::int64_t{});
+	}
+
+	SECTION("replacement policies") {
+		// Many keys give the right values
+		auto const check_values = [](auto replacement) {
+			tls::cache<int, int, -1, 64UL, 2, decltype(replacement)> cache;
+			for (int i = 0; i < 1000; i++) {
+				int const key = (i * 7) % 23;
+				REQUIRE(cache.get_or(key, [](int k) { return k * 3; }) == key * 3);
+			}
+		};
+		check_values(tls::replacement::fifo{});
+		check_values(tls::replacement::round_robin{});
+		check_values(tls::replacement::random{});
+		check_values(tls::replacement::lru{});
+		check_values(tls::replacement::clock{});
+
+		// Fills a cache, hits the first key, and inserts one more key.
+		// Returns the misses when looking up the first and second keys again.
+		auto const misses_after_hit = [](auto replacement) {
+			using cache_t = tls::cache<int, int, -1, 64UL, 1, decltype(replacement)>;
+			cache_t cache;
+			int misses = 0;
+			auto const calc_val = [&misses](int key) {
+				misses++;
+				return key;
+			};
+
+			int const ways = static_cast<int>(cache_t::ways());
+			for (int i = 0; i < ways; i++)
+				cache.get_or(i, calc_val);
+			cache.get_or(0, calc_val);
+			cache.get_or(ways, calc_val);
+
+			misses = 0;
+			cache.get_or(0, calc_val);
+			cache.get_or(1, calc_val);
+			return misses;
+		};
+
+		// fifo and round_robin evict the oldest entry, even if it was hit
+		REQUIRE(misses_after_hit(tls::replacement::fifo{}) == 2);
+		REQUIRE(misses_after_hit(tls::replacement::round_robin{}) == 2);
+
+		// lru and clock keep it around, and evict the second key instead
+		REQUIRE(misses_after_hit(tls::replacement::lru{}) == 1);
+		REQUIRE(misses_after_hit(tls::replacement::clock{}) == 1);
+
+		// The state of the policy fits in the line
+		REQUIRE(sizeof(tls::cache<int, int, -1, 64UL, 1, tls::replacement::lru>) == 64UL);
+		REQUIRE(sizeof(tls::cache<int, int, -1, 64UL, 1, tls::replacement::clock>) == 64UL);
+	}
+
+	SECTION("stats are counted") {
+		tls::cache<int, int, -1, 64UL, 1, tls::replacement::fifo, tls::cache_stats::local> cache;
+		int const ways = static_cast<int>(cache.ways());
+		for (int i = 0; i <= ways; i++)
+			cache.get_or(i, [](int k) { return k; });
+		cache.get_or(ways, [](int k) { return k; });
+
+		tls::cache_counters const c = cache.stats();
+		REQUIRE(c.hits == 1);
+		REQUIRE(c.misses == static_cast<std::uint64_t>(ways + 1));
+		REQUIRE(c.evictions == 1);
+
+		// Without stats, no space is used
+		REQUIRE(sizeof(tls::cache<int, int, -1>) == 64UL);
+	}
+
+	SECTION("stats are collected from all threads") {
+		using stats = tls::cache_stats::collected<struct collected_stats>;
+		using cache_t = tls::cache<int, int, -1, 64UL, 1, tls::replacement::fifo, stats>;
+
+		auto const work = [] {
+			cache_t cache;
+			for (int i = 0; i < 4; i++)
+				cache.get_or(i, [](int k) { return k; });
+			for (int i = 0; i < 4; i++)
+				cache.get_or(i, [](int k) { return k; });
+		};
+
+		std::jthread(work).join();
+		std::jthread(work).join();
+		work();
+
+		tls::cache_counters const c = stats::total();
+		REQUIRE(c.hits == 12);
+		REQUIRE(c.misses == 12);
+		REQUIRE(c.evictions == 0);
+	}
+
+	SECTION("sets hold more entries") {
+		using cache_t = tls::cache<int, int, -1, 64UL, 4>;
+		REQUIRE(sizeof(cache_t) == 4 * 64UL);
+		REQUIRE(alignof(cache_t) == 64UL);
+		REQUIRE(cache_t::max_entries() == 4 * cache_t::ways());
+
+		cache_t cache;
+		int calc_count = 0;
+		auto const calc_val = [&calc_count](int key) {
+			calc_count += 1;
+			return key * 2;
+		};
+
+		// Every set can hold at least this many keys without evictions
+		int const num_keys = static_cast<int>(cache_t::ways());
+		for (int i = 0; i < num_keys; i++)
+			REQUIRE(cache.get_or(i, calc_val) == i * 2);
+		for (int i = 0; i < num_keys; i++)
+			REQUIRE(cache.get_or(i, calc_val) == i * 2);
+		REQUIRE(calc_count == num_keys);
+
+		// Many keys still give the right values
+		for (int i = 0; i < 1000; i++)
+			REQUIRE(cache.get_or(i, calc_val) == i * 2);
+	}
+
+	SECTION("caches can be seeded at compile time") {
+		using cache_t = tls::cache<int, int, -1>;
+		static constexpr cache_t image = cache_t::warmed(std::views::iota(0, 8), [](int k) { return k * k; });
+		static_assert(std::is_trivially_copyable_v<cache_t>);
+		static_assert(cache_t{image}.get_or(7, [](int) { return -1; }) == 49);
+
+		// The image is copied into each threads cache, which starts out warm
+		auto const work = [] {
+			thread_local constinit cache_t cache = image;
+			int misses = 0;
+			for (int i = 0; i < 8; i++)
+				CHECK(cache.get_or(i, [&misses](int k) { misses++; return k; }) == i * i);
+			CHECK(misses == 0);
+		};
+		std::jthread(work).join();
+		work();
+
+		// Seeding with pairs keeps the last value of a key
+		constexpr cache_t pairs{{1, 10}, {2, 20}, {1, 11}};
+		static_assert(cache_t{pairs}.get_or(1, [](int) { return -1; }) == 11);
+		static_assert(cache_t{pairs}.get_or(2, [](int) { return -1; }) == 20);
+		static_assert(cache_t{pairs}.get_or(3, [](int) { return -1; }) == -1);
+
+		// Seeding more keys than fit evicts the first ones
+		constexpr int ways = static_cast<int>(cache_t::ways());
+		cache_t overfull = cache_t::warmed(std::views::iota(0, ways + 2), [](int k) { return k; });
+		int misses = 0;
+		for (int i = ways + 2; i-- > 0;)
+			overfull.get_or(i, [&misses](int k) { misses++; return k; });
+		REQUIRE(misses == 2);
+	}
+
+	SECTION("frozen caches never insert") {
+		using cache_t = tls::cache<int, int, -1, 64UL, 1, tls::replacement::frozen, tls::cache_stats::local>;
+		REQUIRE(sizeof(tls::cache<int, int, -1, 64UL, 1, tls::replacement::frozen>) == 64UL);
+
+		constexpr int ways = static_cast<int>(cache_t::ways());
+		cache_t cache = cache_t::warmed(std::views::iota(0, ways + 2), [](int k) { return k + 100; });
+
+		// The keys that did not fit are dropped
+		int calc_count = 0;
+		auto const calc_val = [&calc_count](int key) {
+			calc_count += 1;
+			return key + 100;
+		};
+		for (int round = 0; round < 2; round++)
+			for (int i = 0; i < ways + 2; i++)
+				REQUIRE(cache.get_or(i, calc_val) == i + 100);
+		REQUIRE(calc_count == 2 * 2);
+
+		// Misses are not cached
+		REQUIRE(cache.get_or(1000, calc_val) == 1100);
+		REQUIRE(cache.get_or(1000, calc_val) == 1100);
+		REQUIRE(calc_count == 2 * 2 + 2);
+
+		tls::cache_counters const c = cache.stats();
+		REQUIRE(c.hits == static_cast<std::uint64_t>(2 * ways));
+		REQUIRE(c.misses == 6);
+		REQUIRE(c.evictions == 0);
+	}
+
+	SECTION("indirect caches hold large values") {
+		using cache_t = tls::indirect_cache<int, std::string, -1>;
+
+		// The line holds 16 keys, minus the space for the replacement state
+		REQUIRE(cache_t::ways() == 15);
+
+		cache_t cache;
+		int calc_count = 0;
+		auto const calc_val = [&calc_count](int key) {
+			calc_count += 1;
+			return std::string(100, static_cast<char>('a' + key));
+		};
+
+		std::string const& a = cache.get_or(0, calc_val);
+		REQUIRE(a == std::string(100, 'a'));
+		REQUIRE(&cache.get_or(0, calc_val) == &a);
+		REQUIRE(calc_count == 1);
+
+		for (int i = 0; i < 100; i++)
+			REQUIRE(cache.get_or(i % 20, calc_val) == std::string(100, static_cast<char>('a' + i % 20)));
+	}
+
+	SECTION("indirect and hashed caches can be used by the function computing a value") {
+		auto const fib = [](int n) {
+			std::uint64_t a = 0, b = 1;
+			for (int i = 0; i < n; i++)
+				a = std::exchange(b, a + b);
+			return a;
+		};
+
+		// Computes fibonacci numbers through the cache, so 'or_fn' inserts into the cache
+		// while a lookup is missing
+		auto const check_memoized = [fib](auto cache_type) {
+			using cache_t = typename decltype(cache_type)::type;
+			struct memoized_fib {
+				cache_t& cache;
+				std::uint64_t operator()(int n) const {
+					if (n < 2)
+						return static_cast<std::uint64_t>(n);
+					std::uint64_t const a = cache.get_or(n - 1, *this);
+					return a + cache.get_or(n - 2, *this);
+				}
+			};
+
+			for (int n = 0; n < 30; n++) {
+				cache_t cache;
+				REQUIRE(cache.get_or(n, memoized_fib{cache}) == fib(n));
+
+				// A key left with the value of another key is found before it is evicted
+				for (int m = 0; m <= n; m++)
+					REQUIRE(cache.get_or(m, fib) == fib(m));
+			}
+		};
+
+		// Fills a cache, and makes 'or_fn' throw on a miss. The key is not cached,
+		// and the other keys keep their values.
+		auto const check_throwing = [](auto cache_type) {
+			using cache_t = typename decltype(cache_type)::type;
+			auto const name_of = [](int k) {
+				return std::to_string(k);
+			};
+
+			cache_t cache;
+			int const num_keys = static_cast<int>(cache_t::max_entries());
+			for (int i = 0; i < num_keys; i++)
+				cache.get_or(i, name_of);
+
+			REQUIRE_THROWS(cache.get_or(1000, [](int) -> std::string { throw 1; }));
+			REQUIRE(cache.get_or(1000, name_of) == "1000");
+			for (int i = 0; i < 2 * num_keys; i++)
+				REQUIRE(cache.get_or(i, name_of) == name_of(i));
+		};
+
+		check_memoized(std::type_identity<tls::indirect_cache<int, std::uint64_t, -1, 16UL>>{});
+		check_memoized(std::type_identity<tls::indirect_cache<int, std::uint64_t, -1, 64UL, 2, tls::replacement::lru>>{});
+		check_throwing(std::type_identity<tls::indirect_cache<int, std::string, -1>>{});
+
+		check_memoized(std::type_identity<tls::hashed_cache<int, std::uint64_t, std::hash<int>, std::equal_to<>, 16UL>>{});
+		check_memoized(std::type_identity<tls::hashed_cache<int, std::uint64_t, std::hash<int>, std::equal_to<>, 64UL, 2, tls::replacement::lru>>{});
+		check_throwing(std::type_identity<tls::hashed_cache<int, std::string>>{});
+	}
+
+	SECTION("indirect caches work with the replacement and stats policies") {
+		struct big {
+			int data[16];
+		};
+		tls::indirect_cache<short, big, -1, 64UL, 2, tls::replacement::lru, tls::cache_stats::local> cache;
+
+		for (short i = 0; i < 50; i++)
+			REQUIRE(cache.get_or(i, [](short k) { return big{{k}}; }).data[0] == i);
+		REQUIRE(cache.get_or(49, [](short) { return big{}; }).data[0] == 49);
+		REQUIRE(cache.stats().hits == 1);
+		REQUIRE(cache.stats().misses == 50);
+	}
+
+	SECTION("hashed caches can be searched with other key types") {
+		tls::hashed_cache<std::string, int, std::hash<std::string_view>> cache;
+
+		int calc_count = 0;
+		auto const calc_val = [&calc_count](std::string_view key) {
+			calc_count += 1;
+			return static_cast<int>(key.size());
+		};
+
+		REQUIRE(cache.get_or(std::string_view{"hello"}, calc_val) == 5);
+		REQUIRE(cache.get_or(std::string{"hello"}, calc_val) == 5);
+		REQUIRE(cache.get_or("hello", calc_val) == 5);
+		REQUIRE(calc_count == 1);
+
+		// Many keys still give the right values
+		for (int i = 0; i < 1000; i++) {
+			std::string const key(static_cast<std::size_t>(i % 50), 'x');
+			REQUIRE(cache.get_or(std::string_view{key}, calc_val) == i % 50);
+		}
+	}
+
+	SECTION("hashed caches compare keys when fingerprints collide") {
+		// A hash where every key has the same fingerprint
+		struct bad_hash {
+			std::size_t operator()(int) const noexcept {
+				return 0;
+			}
+		};
+		tls::hashed_cache<int, int, bad_hash, std::equal_to<>, 64UL, 1, tls::replacement::round_robin, tls::cache_stats::local> cache;
+
+		for (int i = 0; i < 8; i++)
+			REQUIRE(cache.get_or(i, [](int k) { return k * 2; }) == i * 2);
+		for (int i = 0; i < 8; i++)
+			REQUIRE(cache.get_or(i, [](int) { return -1; }) == i * 2);
+		REQUIRE(cache.stats().hits == 8);
+		REQUIRE(cache.stats().misses == 8);
+	}
+}
@@ -0,0 +1,54 @@
+#include "../catch.hpp"
+#include <map>
+#include <thread>
+#include <tls/cache.h>
+#include <tls/cached_view.h>
+#include <tls/replicate.h>
+
+TEST_CASE("tls::cached_view<> specification") {
+	using table = std::map<int, int>;
+	using repl_t = tls::replicate<table, struct cached_view_table>;
+
+	SECTION("lookups are cached") {
+		repl_t repl{table{{1, 10}, {2, 20}}};
+		tls::cached_view<repl_t, tls::cache<int, int, -1>> view{repl};
+
+		int lookups = 0;
+		auto const lookup = [&lookups](table const& t, int k) {
+			lookups++;
+			return t.at(k);
+		};
+
+		REQUIRE(view.get_or(1, lookup) == 10);
+		REQUIRE(view.get_or(1, lookup) == 10);
+		REQUIRE(view.get_or(2, lookup) == 20);
+		REQUIRE(lookups == 2);
+	}
+
+	SECTION("writes invalidate the threads caches") {
+		repl_t repl{table{{1, 10}}};
+		tls::cached_view<repl_t, tls::cache<int, int, -1>> view{repl};
+
+		int lookups = 0;
+		auto const lookup = [&lookups](table const& t, int k) {
+			lookups++;
+			return t.at(k);
+		};
+
+		// Cached by this thread, so the lookup after the write must miss
+		REQUIRE(view.get_or(1, lookup) == 10);
+		REQUIRE(view.get_or(1, lookup) == 10);
+		REQUIRE(lookups == 1);
+
+		repl.write(table{{1, 11}});
+		REQUIRE(view.get_or(1, lookup) == 11);
+		REQUIRE(lookups == 2);
+		REQUIRE(view.get_or(1, lookup) == 11);
+		REQUIRE(lookups == 2);
+
+		// Other threads start with an empty cache, and see the new data
+		int thread_value = 0;
+		std::jthread([&] { thread_value = view.get_or(1, [](table const& t, int k) { return t.at(k); }); }).join();
+		REQUIRE(thread_value == 11);
+	}
+}
@@ -1,158 +1,523 @@
-#include "../catch.hpp"
-#include <execution>
-#include <thread>
-#include <tls/collect.h>
-#include <tls/split.h>
-
-TEST_CASE("tls::collect<> specification") {
-	SECTION("new instances are default initialized") {
-		struct test {
-			int x = 4;
-		};
-		REQUIRE(tls::collect<int>().local() == int{});
-		REQUIRE(tls::collect<double>().local() == double{});
-		REQUIRE(tls::collect<test>().local().x == test{}.x);
-	}
-
-	SECTION("does not cause data races") {
-		std::vector<int> vec(1024 * 1024, 1);
-		tls::unique_collect<int> acc1;
-		tls::unique_collect<int> acc2;
-
-		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const i) {
-			acc1.local() += 1 * i;
-			acc2.local() += 2 * i;
-		});
-
-		auto collect = acc1.gather();
-		int result1 = std::reduce(collect.begin(), collect.end());
-		REQUIRE(result1 == 1024 * 1024);
-
-		collect = acc2.gather();
-		int result2 = std::reduce(collect.begin(), collect.end());
-		REQUIRE(result2 == 2 * 1024 * 1024);
-	}
-
-	SECTION("gather cleans up properly") {
-		std::vector<int> vec(1024, 1);
-		tls::collect<int> acc;
-
-		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
-			acc.local() += i;
-		});
-
-		acc.for_each([](int const& i) {
-			REQUIRE(i > 0);
-		});
-		(void)acc.gather();
-		acc.for_each([](int const& i) {
-			REQUIRE(i == 0);
-		});
-	}
-
-	SECTION("clearing after use cleans up properly") {
-		std::vector<int> vec(1024, 1);
-		tls::collect<int> acc;
-
-		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
-			acc.local() += i;
-		});
-
-		acc.clear();
-		auto const collect = acc.gather();
-		for (int val : collect)
-			CHECK(val == 0);
-	}
-
-	SECTION("multiple instances in same scope points to the same data") {
-		tls::collect<int> s1, s2, s3;
-		s1.local() = 1;
-		s2.local() = 2;
-		s3.local() = 3;
-		CHECK(s1.local() == 3);
-		CHECK(s2.local() == 3);
-		CHECK(s3.local() == 3);
-	}
-
-	SECTION("data persist between out-of-scope instances") {
-		{
-			tls::collect<int> s1;
-			s1.local() = 1;
-		}
-
-		{
-			tls::collect<int> s2;
-			CHECK(s2.local() == 1);
-		}
-	}
-
-	SECTION("gather flatten works") {
-		std::vector<int> vec(std::thread::hardware_concurrency(), 1);
-		tls::collect<std::vector<int>> collector;
-		std::atomic_size_t counter = 0;
-
-		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const&) {
-			collector.local().push_back(2);
-			counter += 1;
-		});
-
-		vec.clear();
-		collector.gather_flattened(std::back_inserter(vec));
-		REQUIRE(vec.size() == counter);
-		for (int i : vec)
-			REQUIRE(2 == i);
-	}
-
-	SECTION("data persists after thread deaths") {
-		tls::unique_collect<int> collector;
-
-		{
-			std::vector<std::jthread> threads;
-			for (int i = 0; i < 10; i++) {
-				threads.emplace_back([&collector, i]() {
-					collector.local() = i;
-				});
-			}
-		}
-
-		auto collection = collector.gather();
-		std::sort(collection.begin(), collection.end());
-		REQUIRE(collection.size() == 10);
-		for (int i = 0; i < 10; i++) {
-			CHECK(collection[i] == i);
-		}
-	}
-
-	SECTION("tls::unique_collect<> are unique") {
-		tls::unique_collect<int> s4;
-		tls::unique_collect<int> s5;
-		tls::unique_collect<int> s6;
-		s4.local() = 1;
-		s5.local() = 2;
-		s6.local() = 3;
-		CHECK(s4.local() == 1);
-		CHECK(s5.local() == 2);
-		CHECK(s6.local() == 3);
-	}
-
-	SECTION("xx") {
-		tls::collect<float> cf;
-		cf.local() += 1.23f;
-
-		cf.for_each([](float const&) {});
-		cf.for_each([](float&) {});
-	}
-
-	SECTION("can use different containers") {
-		tls::collect<int, std::list> cf;
-		cf.local() = 132;
-		auto collected = cf.gather();
-		REQUIRE(collected.front() == 132);
-	}
-
-	SECTION("can use no container") {
-		tls::split<int> splitter;
-		tls::collect<int, tls::none> collector;
-		REQUIRE(&splitter.local() == &collector.local());
-	}
-}
\ No newline at end of file
+#include "../catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <functional>
+#include <list>
+#include <numeric>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tls/collect.h>
+#include <tls/split.h>
+
+TEST_CASE("tls::collect<> specification") {
+	SECTION("new instances are default initialized") {
+		struct test {
+			int x = 4;
+		};
+		REQUIRE(tls::collect<int>().local() == int{});
+		REQUIRE(tls::collect<double>().local() == double{});
+		REQUIRE(tls::collect<test>().local().x == test{}.x);
+	}
+
+	SECTION("does not cause data races") {
+		std::vector<int> vec(1024 * 1024, 1);
+		tls::unique_collect<int> acc1;
+		tls::unique_collect<int> acc2;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const i) {
+			acc1.local() += 1 * i;
+			acc2.local() += 2 * i;
+		});
+
+		auto collect = acc1.gather();
+		int result1 = std::reduce(collect.begin(), collect.end());
+		REQUIRE(result1 == 1024 * 1024);
+
+		collect = acc2.gather();
+		int result2 = std::reduce(collect.begin(), collect.end());
+		REQUIRE(result2 == 2 * 1024 * 1024);
+	}
+
+	SECTION("gather cleans up properly") {
+		std::vector<int> vec(1024, 1);
+		tls::collect<int> acc;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
+			acc.local() += i;
+		});
+
+		acc.for_each([](int const& i) {
+			REQUIRE(i > 0);
+		});
+		(void)acc.gather();
+		acc.for_each([](int const& i) {
+			REQUIRE(i == 0);
+		});
+	}
+
+	SECTION("reduce does not modify the data") {
+		std::vector<int> vec(1024, 1);
+		tls::unique_collect<int> acc;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
+			acc.local() += i;
+		});
+
+		REQUIRE(acc.reduce(0, std::plus<>{}) == 1024);
+		REQUIRE(acc.reduce(0, std::plus<>{}) == 1024);
+	}
+
+	SECTION("reduce_and_reset cleans up properly") {
+		std::vector<int> vec(1024, 1);
+		tls::unique_collect<int> acc;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
+			acc.local() += i;
+		});
+		std::jthread([&acc] { acc.local() = 24; }).join();
+
+		REQUIRE(acc.reduce_and_reset(0, std::plus<>{}) == 1024 + 24);
+		REQUIRE(acc.reduce(0, std::plus<>{}) == 0);
+	}
+
+	SECTION("combine merges all the data and cleans up properly") {
+		using collector = tls::unique_collect<std::vector<int>>;
+		REQUIRE(collector::combine([](std::vector<int>&& a, std::vector<int>&&) { return std::move(a); }).empty());
+
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 12; i++)
+				threads.emplace_back([i] { collector::local().push_back(i); });
+		}
+		collector::local().push_back(12);
+
+		std::atomic_int merges = 0;
+		std::vector<int> combined = collector::combine([&merges](std::vector<int>&& a, std::vector<int>&& b) {
+			merges++;
+			a.insert(a.end(), b.begin(), b.end());
+			return std::move(a);
+		});
+		std::ranges::sort(combined);
+		REQUIRE(combined == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+		REQUIRE(merges == 12);
+		REQUIRE(collector::reduce(std::size_t{0}, [](std::size_t n, std::vector<int> const& v) { return n + v.size(); }) == 0);
+	}
+
+	SECTION("combine keeps the order of the data") {
+		using collector = tls::unique_collect<std::string>;
+		{
+			std::vector<std::jthread> threads;
+			for (char c = 'a'; c <= 'g'; c++)
+				threads.emplace_back([c] { collector::local() = c; });
+		}
+		auto const order = collector::reduce(std::string{}, std::plus<>{});
+		REQUIRE(collector::combine([](std::string&& a, std::string&& b) { return std::move(a) + b; }) == order);
+	}
+
+	SECTION("snapshots do not block threads from starting or exiting") {
+		tls::unique_collect<int> acc;
+		acc.local() = 1;
+
+		int sum = 0;
+		acc.for_each_snapshot([&](int const& i) {
+			sum += i;
+
+			// a for_each(...) would deadlock here, because the exiting thread
+			// has to wait for the traversal to finish
+			std::jthread([&acc] { acc.local() = 2; }).join();
+		});
+
+		REQUIRE(sum == 1);
+		REQUIRE(acc.reduce(0, std::plus<>{}) == 3);
+	}
+
+	SECTION("clearing after use cleans up properly") {
+		std::vector<int> vec(1024, 1);
+		tls::collect<int> acc;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&acc](int const i) {
+			acc.local() += i;
+		});
+
+		acc.clear();
+		auto const collect = acc.gather();
+		for (int val : collect)
+			CHECK(val == 0);
+	}
+
+	SECTION("multiple instances in same scope points to the same data") {
+		tls::collect<int> s1, s2, s3;
+		s1.local() = 1;
+		s2.local() = 2;
+		s3.local() = 3;
+		CHECK(s1.local() == 3);
+		CHECK(s2.local() == 3);
+		CHECK(s3.local() == 3);
+	}
+
+	SECTION("data persist between out-of-scope instances") {
+		{
+			tls::collect<int> s1;
+			s1.local() = 1;
+		}
+
+		{
+			tls::collect<int> s2;
+			CHECK(s2.local() == 1);
+		}
+	}
+
+	SECTION("gather_into reuses the containers storage") {
+		tls::unique_collect<int> collector;
+		std::jthread([&collector] { collector.local() = 1; }).join();
+		collector.local() = 2;
+
+		std::vector<int> out(16, -1);
+		out.reserve(64);
+		int const* const storage = out.data();
+
+		collector.gather_into(out);
+		REQUIRE(out == std::vector<int>{1, 2});
+		REQUIRE(out.data() == storage);
+
+		collector.gather_into(out);
+		REQUIRE(out == std::vector<int>{0});
+		REQUIRE(out.data() == storage);
+	}
+
+	SECTION("swap_local lets threads keep the spare buffers capacity") {
+		tls::unique_collect<std::vector<int>> collector;
+		collector.local().push_back(1);
+
+		std::vector<std::vector<int>> buffers(3);
+		buffers[0].reserve(1000);
+
+		collector.swap_local(buffers);
+		REQUIRE(buffers.size() == 1);
+		REQUIRE(buffers[0] == std::vector<int>{1});
+		REQUIRE(collector.local().empty());
+		REQUIRE(collector.local().capacity() >= 1000);
+	}
+
+	SECTION("gather flatten works") {
+		std::vector<int> vec(std::thread::hardware_concurrency(), 1);
+		tls::collect<std::vector<int>> collector;
+		std::atomic_size_t counter = 0;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const&) {
+			collector.local().push_back(2);
+			counter += 1;
+		});
+
+		vec.clear();
+		collector.gather_flattened(std::back_inserter(vec));
+		REQUIRE(vec.size() == counter);
+		for (int i : vec)
+			REQUIRE(2 == i);
+	}
+
+	SECTION("gather flatten into a vector works") {
+		tls::unique_collect<std::vector<int>> collector;
+		std::jthread([&collector] { collector.local().assign(100'000, 1); }).join();
+
+		std::vector<int> vec(std::thread::hardware_concurrency(), 1);
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const&) {
+			collector.local().push_back(2);
+		});
+
+		std::vector<int> dest{3};
+		collector.gather_flattened(dest);
+		REQUIRE(dest.size() == 1 + 100'000 + vec.size());
+		REQUIRE(dest.front() == 3);
+		REQUIRE(std::count(dest.begin(), dest.end(), 1) == 100'000);
+		REQUIRE(std::count(dest.begin(), dest.end(), 2) == static_cast<std::ptrdiff_t>(vec.size()));
+
+		collector.for_each([](std::vector<int> const& v) {
+			REQUIRE(v.empty());
+		});
+	}
+
+	SECTION("gather flatten into a vector works with non-trivial types") {
+		tls::unique_collect<std::list<std::string>> collector;
+		collector.local().assign(10, "tls");
+
+		std::vector<std::string> dest;
+		collector.gather_flattened(dest);
+		REQUIRE(dest == std::vector<std::string>(10, "tls"));
+	}
+
+	SECTION("data persists after thread deaths") {
+		tls::unique_collect<int> collector;
+
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 10; i++) {
+				threads.emplace_back([&collector, i]() {
+					collector.local() = i;
+				});
+			}
+		}
+
+		auto collection = collector.gather();
+		std::sort(collection.begin(), collection.end());
+		REQUIRE(collection.size() == 10);
+		for (int i = 0; i < 10; i++) {
+			CHECK(collection[i] == i);
+		}
+	}
+
+	SECTION("threads can start and exit during traversals") {
+		tls::unique_collect<int> collector;
+		std::atomic_bool done = false;
+
+		std::jthread traverser([&] {
+			while (!done) {
+				collector.for_each([](int const&) {});
+			}
+		});
+
+		for (int wave = 0; wave < 16; wave++) {
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 50; i++)
+				threads.emplace_back([&collector] { collector.local() = 1; });
+		}
+		done = true;
+
+		auto const collection = collector.gather();
+		REQUIRE(collection.size() == 16 * 50);
+		REQUIRE(std::reduce(collection.begin(), collection.end()) == 16 * 50);
+	}
+
+	SECTION("tls::unique_collect<> are unique") {
+		tls::unique_collect<int> s4;
+		tls::unique_collect<int> s5;
+		tls::unique_collect<int> s6;
+		s4.local() = 1;
+		s5.local() = 2;
+		s6.local() = 3;
+		CHECK(s4.local() == 1);
+		CHECK(s5.local() == 2);
+		CHECK(s6.local() == 3);
+	}
+
+	SECTION("xx") {
+		tls::collect<float> cf;
+		cf.local() += 1.23f;
+
+		cf.for_each([](float const&) {});
+		cf.for_each([](float&) {});
+	}
+
+	SECTION("handles point to the threads data") {
+		using collector = tls::unique_collect<int>;
+		auto const h = collector::handle();
+		*h = 3;
+		REQUIRE(&h.get() == &collector::local());
+		REQUIRE(collector::local() == 3);
+
+		int* other = nullptr;
+		std::jthread([&other] {
+			auto const h2 = collector::handle();
+			*h2 = 4;
+			other = &*h2;
+		}).join();
+		REQUIRE(other != &*h);
+		REQUIRE(collector::reduce(0, std::plus<>{}) == 7);
+	}
+
+	SECTION("thread data is aligned to the cache line") {
+		tls::collect<char> c1;
+		tls::collect<int, std::vector, void, 128> c2;
+		CHECK(reinterpret_cast<std::uintptr_t>(&c1.local()) % 64 == 0);
+		CHECK(reinterpret_cast<std::uintptr_t>(&c2.local()) % 128 == 0);
+	}
+
+	SECTION("can use different containers") {
+		tls::collect<int, std::list> cf;
+		cf.local() = 132;
+		auto collected = cf.gather();
+		REQUIRE(collected.front() == 132);
+	}
+
+	SECTION("can use no container") {
+		tls::split<int> splitter;
+		tls::collect<int, tls::none> collector;
+		REQUIRE(&splitter.local() == &collector.local());
+	}
+
+	SECTION("pooled slots keep the data of expired threads until it is gathered") {
+		using collector = tls::collect<int, std::vector, struct pooled, 64UL, tls::pooled_slots>;
+
+		int* slots[2] = {};
+		for (int i = 0; i < 2; i++) {
+			std::jthread([&slots, i] {
+				collector::local() = i + 1;
+				slots[i] = &collector::local();
+			}).join();
+		}
+
+		// The data stays in the retired slots
+		REQUIRE(collector::reduce(0, std::plus<>{}) == 3);
+
+		auto const data = collector::gather();
+		REQUIRE(std::accumulate(data.begin(), data.end(), 0) == 3);
+
+		// The retired slots are reused by new threads, with fresh data
+		int* reused_slot = nullptr;
+		int reused_value = -1;
+		std::jthread([&] {
+			reused_value = collector::local();
+			reused_slot = &collector::local();
+		}).join();
+		REQUIRE(reused_value == 0);
+		REQUIRE((reused_slot == slots[0] || reused_slot == slots[1]));
+		REQUIRE(collector::gather().size() == 1);
+	}
+
+	SECTION("pooled slots with many threads") {
+		using collector = tls::collect<int, std::vector, struct pooled_churn, 64UL, tls::pooled_slots>;
+
+		for (int round = 0; round < 10; round++) {
+			{
+				std::vector<std::jthread> threads;
+				for (int i = 0; i < 8; i++)
+					threads.emplace_back([] { collector::local() += 1; });
+			}
+
+			auto const data = collector::gather();
+			REQUIRE(std::accumulate(data.begin(), data.end(), 0) == 8);
+		}
+	}
+
+	SECTION("pooled slots can be gathered while snapshots are taken") {
+		using collector = tls::collect<int, std::vector, struct pooled_snapshots, 64UL, tls::pooled_slots>;
+
+		// Gathers reclaim the retired slots, which must not wait on a snapshot that waits on the gather.
+		// Threads expire at any time, but their writes are kept out of the gathers by 'writes'.
+		std::atomic_bool done = false;
+		std::shared_mutex writes;
+		int gathered = 0;
+		std::jthread gatherer([&] {
+			while (!done) {
+				std::unique_lock const lock(writes);
+				for (int const v : collector::gather())
+					gathered += v;
+			}
+		});
+		std::jthread snapshotter([&] {
+			while (!done) {
+				collector::for_each_snapshot([](int) {});
+				(void)collector::reduce_snapshot(0, std::plus<>{});
+			}
+		});
+
+		for (int i = 0; i < 2'000; i++) {
+			std::jthread([&writes] {
+				std::shared_lock const lock(writes);
+				std::atomic_ref<int>(collector::local()).fetch_add(1, std::memory_order_relaxed);
+			}).join();
+		}
+		done = true;
+		gatherer.join();
+		snapshotter.join();
+
+		for (int const v : collector::gather())
+			gathered += v;
+		REQUIRE(gathered == 2'000);
+	}
+
+	SECTION("recycled slots hand the data of expired threads to new threads") {
+		using splitter = tls::recycled_split<std::vector<char>, struct recycled>;
+
+		char const* buffer = nullptr;
+		std::jthread([&buffer] {
+			splitter::local().reserve(4096);
+			splitter::local().push_back('x');
+			buffer = splitter::local().data();
+		}).join();
+
+		// The next thread adopts the buffer with its contents and capacity
+		std::size_t capacity = 0;
+		char const* adopted = nullptr;
+		std::jthread([&] {
+			capacity = splitter::local().capacity();
+			adopted = splitter::local().data();
+		}).join();
+		REQUIRE(adopted == buffer);
+		REQUIRE(capacity >= 4096);
+	}
+
+	SECTION("recycled slots with many threads") {
+		using splitter = tls::recycled_split<int, struct recycled_churn>;
+
+		std::atomic_int max_uses = 0;
+		for (int round = 0; round < 10; round++) {
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 8; i++)
+				threads.emplace_back([&max_uses] {
+					int const uses = ++splitter::local();
+					int seen = max_uses.load();
+					while (seen < uses && !max_uses.compare_exchange_weak(seen, uses)) {
+					}
+				});
+		}
+
+		// The slots were reused by later threads
+		REQUIRE(max_uses > 1);
+	}
+
+	SECTION("recycled slots are gathered once") {
+		using collector = tls::collect<int, std::vector, struct recycled_gather, 64UL, tls::recycled_slots>;
+
+		// The data of the first thread is collected when it exits, and the second thread adopts its slot
+		std::jthread([] { collector::local() = 5; }).join();
+		std::jthread([] { collector::local() += 1; }).join();
+
+		auto const data = collector::gather();
+		REQUIRE(std::accumulate(data.begin(), data.end(), 0) == 6);
+	}
+
+	SECTION("per-cpu slots are shared by the threads") {
+		using collector = tls::collect<int, std::vector, struct per_cpu, 64UL, tls::per_cpu_slots>;
+
+		std::vector<int> vec(64 * 1024, 1);
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [](int const i) {
+			*collector::local() += i;
+		});
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 64; i++)
+				threads.emplace_back([] { *collector::local() += 1; });
+		}
+
+		// There is at most one slot per cpu, no matter how many threads used them
+		std::size_t slots = 0;
+		collector::for_each([&slots](int const&) { slots++; });
+		REQUIRE(slots >= 1);
+		REQUIRE(slots <= std::max(1u, std::thread::hardware_concurrency()));
+
+		REQUIRE(collector::reduce_snapshot(0, std::plus<>{}) == 64 * 1024 + 64);
+		auto const data = collector::gather();
+		REQUIRE(std::accumulate(data.begin(), data.end(), 0) == 64 * 1024 + 64);
+		REQUIRE(collector::reduce(0, std::plus<>{}) == 0);
+	}
+
+	SECTION("per-cpu slots can be locked again by the thread holding them") {
+		using collector = tls::collect<int, std::vector, struct per_cpu_nested, 64UL, tls::per_cpu_slots>;
+		{
+			auto outer = collector::local();
+			*outer += 1;
+			auto inner = collector::local();
+			*inner += 1;
+			REQUIRE(&*inner == &*outer);
+
+			// Traversals from the thread skip the slot it holds
+			REQUIRE(collector::reduce(0, std::plus<>{}) == 2);
+		}
+		REQUIRE(collector::reduce(0, std::plus<>{}) == 2);
+	}
+}
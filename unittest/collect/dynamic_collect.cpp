@@ -0,0 +1,121 @@
+#include "../catch.hpp"
+#include <condition_variable>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <tls/dynamic_collect.h>
+#include <tls/split.h>
+
+TEST_CASE("tls::dynamic_collect<> specification") {
+	SECTION("new instances are default initialized") {
+		REQUIRE(tls::dynamic_collect<int>().local() == int{});
+		REQUIRE(tls::dynamic_collect<double>().local() == double{});
+	}
+
+	SECTION("multiple instances in same scope have their own data") {
+		tls::dynamic_collect<int> s1, s2, s3;
+		s1.local() = 1;
+		s2.local() = 2;
+		s3.local() = 3;
+		CHECK(s1.local() == 1);
+		CHECK(s2.local() == 2);
+		CHECK(s3.local() == 3);
+	}
+
+	SECTION("data does not persist between out-of-scope instances") {
+		for (int i = 0; i < 4; i++) {
+			tls::dynamic_collect<int> s;
+			CHECK(s.local() == 0);
+			s.local() = 1;
+		}
+	}
+
+	SECTION("does not cause data races") {
+		std::vector<int> vec(1024 * 1024, 1);
+		tls::dynamic_collect<int> acc1;
+		tls::dynamic_collect<int> acc2;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const i) {
+			acc1.local() += 1 * i;
+			acc2.local() += 2 * i;
+		});
+
+		REQUIRE(acc1.reduce(0, std::plus<>{}) == 1024 * 1024);
+		REQUIRE(acc2.reduce(0, std::plus<>{}) == 2 * 1024 * 1024);
+	}
+
+	SECTION("data persists after thread deaths") {
+		tls::dynamic_collect<int> collector;
+
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 10; i++) {
+				threads.emplace_back([&collector, i]() {
+					collector.local() = i;
+				});
+			}
+		}
+
+		auto collection = collector.gather();
+		std::sort(collection.begin(), collection.end());
+		REQUIRE(collection.size() == 10);
+		for (int i = 0; i < 10; i++) {
+			CHECK(collection[i] == i);
+		}
+	}
+
+	SECTION("instances can be destroyed before the threads that used them") {
+		auto collector = std::make_unique<tls::dynamic_collect<std::vector<int>>>();
+		std::mutex mtx;
+		std::condition_variable cv;
+		bool pushed = false;
+		bool destroyed = false;
+
+		std::jthread thread([&] {
+			collector->local().push_back(1);
+			std::unique_lock ul(mtx);
+			pushed = true;
+			cv.notify_all();
+			cv.wait(ul, [&] { return destroyed; });
+		});
+
+		// The thread is done with its data, which is still alive
+		{
+			std::unique_lock ul(mtx);
+			cv.wait(ul, [&] { return pushed; });
+		}
+		REQUIRE(collector->reduce(0, [](int sum, auto const& v) { return sum + static_cast<int>(v.size()); }) == 1);
+		collector.reset();
+
+		{
+			std::scoped_lock sl(mtx);
+			destroyed = true;
+		}
+		cv.notify_all();
+	}
+
+	SECTION("gather flatten works") {
+		std::vector<int> vec(std::thread::hardware_concurrency(), 1);
+		tls::dynamic_collect<std::vector<int>> collector;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const&) {
+			collector.local().push_back(2);
+		});
+
+		std::vector<int> result;
+		collector.gather_flattened(std::back_inserter(result));
+		REQUIRE(result.size() == vec.size());
+		for (int i : result)
+			REQUIRE(2 == i);
+	}
+
+	SECTION("can use no container") {
+		tls::dynamic_split<int> splitter;
+		splitter.local() = 4;
+		std::jthread([&splitter] { splitter.local() = 2; }).join();
+		REQUIRE(splitter.reduce(0, std::plus<>{}) == 4);
+	}
+}
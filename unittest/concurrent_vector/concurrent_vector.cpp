@@ -0,0 +1,106 @@
+#include "../catch.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <execution>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tls/concurrent_vector.h>
+
+TEST_CASE("tls::concurrent_vector<> specification") {
+	SECTION("new vectors are empty") {
+		tls::concurrent_vector<int> cv;
+		REQUIRE(cv.empty());
+		REQUIRE(cv.segments().empty());
+	}
+
+	SECTION("threads can append concurrently") {
+		std::vector<int> input(64 * 1024);
+		std::iota(input.begin(), input.end(), 0);
+
+		tls::concurrent_vector<int, 100> cv;
+		std::for_each(std::execution::par, input.begin(), input.end(), [&cv](int i) {
+			cv.push_back(i);
+		});
+		REQUIRE(cv.size() == input.size());
+
+		std::vector<int> flat;
+		cv.flatten_into(flat);
+		std::ranges::sort(flat);
+		REQUIRE(flat == input);
+		REQUIRE(cv.empty());
+	}
+
+	SECTION("elements do not move when segments are added") {
+		tls::concurrent_vector<std::string, 4> cv;
+		std::string const& first = cv.emplace_back(64, 'a');
+		std::string const* const address = &first;
+		for (int i = 0; i < 100; i++)
+			cv.push_back(std::to_string(i));
+
+		REQUIRE(&first == address);
+		REQUIRE(first == std::string(64, 'a'));
+		REQUIRE(cv.segments().size() == 26);
+	}
+
+	SECTION("segments are viewed in place and aligned") {
+		tls::concurrent_vector<int, 16> cv;
+		int* const first = &cv.push_back(1);
+		cv.push_back(2);
+
+		auto const views = cv.segments();
+		REQUIRE(views.size() == 1);
+		REQUIRE(views[0].data() == first);
+		REQUIRE(views[0].size() == 2);
+		REQUIRE(reinterpret_cast<std::uintptr_t>(first) % 64 == 0);
+	}
+
+	SECTION("data persists after thread deaths") {
+		tls::concurrent_vector<std::unique_ptr<int>, 8> cv;
+		{
+			std::vector<std::jthread> threads;
+			for (int t = 0; t < 8; t++)
+				threads.emplace_back([&cv, t] {
+					for (int i = 0; i < 10; i++)
+						cv.push_back(std::make_unique<int>(t * 10 + i));
+				});
+		}
+		REQUIRE(cv.size() == 80);
+
+		std::vector<std::unique_ptr<int>> flat;
+		cv.flatten_into(flat);
+		int sum = 0;
+		for (auto const& p : flat)
+			sum += *p;
+		REQUIRE(sum == 79 * 80 / 2);
+	}
+
+	SECTION("sort_into sorts and merges the segments") {
+		std::vector<int> input(10'000);
+		std::iota(input.begin(), input.end(), 0);
+		std::vector<int> shuffled = input;
+		std::ranges::reverse(shuffled);
+
+		tls::concurrent_vector<int, 64> cv;
+		std::for_each(std::execution::par, shuffled.begin(), shuffled.end(), [&cv](int i) {
+			cv.push_back(i);
+		});
+
+		std::vector<int> sorted{-1};
+		cv.sort_into(sorted);
+		REQUIRE(sorted.front() == -1);
+		REQUIRE(std::equal(sorted.begin() + 1, sorted.end(), input.begin(), input.end()));
+
+		std::jthread([&cv] {
+			for (int i = 0; i < 3; i++)
+				cv.push_back(i);
+		}).join();
+		cv.push_back(1);
+		std::vector<int> descending;
+		cv.sort_into(descending, std::greater<>{});
+		REQUIRE(descending == std::vector<int>{2, 1, 1, 0});
+	}
+}
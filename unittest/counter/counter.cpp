@@ -0,0 +1,67 @@
+#include "../catch.hpp"
+#include <atomic>
+#include <execution>
+#include <thread>
+#include <vector>
+#include <tls/counter.h>
+
+TEST_CASE("tls::counter<> specification") {
+	SECTION("new counters are zero") {
+		REQUIRE(tls::unique_counter<int>::read() == 0);
+	}
+
+	SECTION("sums the threads counts") {
+		std::vector<int> vec(1024 * 1024, 1);
+		tls::unique_counter<long> counter;
+
+		std::for_each(std::execution::par, vec.begin(), vec.end(), [&](int const i) {
+			counter.add(i);
+		});
+
+		REQUIRE(counter.read() == 1024 * 1024);
+	}
+
+	SECTION("counts persist after thread deaths") {
+		tls::unique_counter<unsigned> counter;
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 10; i++) {
+				threads.emplace_back([&counter]() {
+					counter.add(3);
+					counter.sub(1);
+				});
+			}
+		}
+
+		REQUIRE(counter.read() == 20);
+	}
+
+	SECTION("can be read while threads are adding and exiting") {
+		tls::unique_counter<int> counter;
+		std::atomic_bool done = false;
+		bool monotonic = true;
+
+		std::jthread reader([&] {
+			int last = 0;
+			while (!done) {
+				int const current = counter.read();
+				monotonic = monotonic && (current >= last);
+				last = current;
+			}
+		});
+
+		for (int wave = 0; wave < 16; wave++) {
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 16; i++)
+				threads.emplace_back([&counter] {
+					for (int n = 0; n < 100; n++)
+						counter.add(1);
+				});
+		}
+		done = true;
+		reader.join();
+
+		CHECK(monotonic);
+		REQUIRE(counter.read() == 16 * 16 * 100);
+	}
+}
@@ -0,0 +1,108 @@
+#include "../catch.hpp"
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <tls/histogram.h>
+
+TEST_CASE("tls::histogram<> specification") {
+	SECTION("new histograms are empty") {
+		auto const s = tls::unique_histogram<>::read();
+		REQUIRE(s.count() == 0);
+		REQUIRE(s.percentile(50) == 0);
+		REQUIRE(s.min() == 0);
+		REQUIRE(s.max() == 0);
+	}
+
+	SECTION("buckets are log-linear") {
+		using histogram = tls::histogram<3>;
+		REQUIRE(histogram::num_buckets == 62 * 8);
+
+		// Small values get a bucket each
+		for (std::uint64_t v = 0; v < 16; v++)
+			REQUIRE(histogram::bucket_of(v) == v);
+
+		// Every value is in its bucket, and buckets are within 1/8 of their lowest value
+		for (std::uint64_t const v : std::vector<std::uint64_t>{16, 17, 100, 1000, 123456789, UINT64_MAX / 3, UINT64_MAX}) {
+			std::size_t const b = histogram::bucket_of(v);
+			REQUIRE(histogram::lowest_value(b) <= v);
+			REQUIRE(v <= histogram::highest_value(b));
+			REQUIRE((histogram::highest_value(b) - histogram::lowest_value(b)) <= histogram::lowest_value(b) / 8);
+		}
+		REQUIRE(histogram::bucket_of(UINT64_MAX) == histogram::num_buckets - 1);
+
+		// Buckets are contiguous
+		for (std::size_t b = 0; b + 1 < histogram::num_buckets; b++)
+			REQUIRE(histogram::highest_value(b) + 1 == histogram::lowest_value(b + 1));
+	}
+
+	SECTION("merges the threads counts") {
+		using histogram = tls::unique_histogram<>;
+		std::vector<std::uint64_t> values(100'000);
+		std::iota(values.begin(), values.end(), 1);
+
+		std::for_each(std::execution::par, values.begin(), values.end(), [](std::uint64_t v) {
+			histogram::record(v);
+		});
+
+		auto const s = histogram::read();
+		REQUIRE(s.count() == 100'000);
+		REQUIRE(s.min() == 1);
+		REQUIRE(s.max() >= 100'000);
+		REQUIRE(std::accumulate(s.buckets().begin(), s.buckets().end(), std::uint64_t{0}) == 100'000);
+
+		// Percentiles are within the precision of the buckets
+		std::uint64_t const median = s.percentile(50);
+		REQUIRE(median >= 50'000);
+		REQUIRE(median <= 50'000 + 50'000 / 32);
+	}
+
+	SECTION("counts persist after thread deaths") {
+		using histogram = tls::unique_histogram<>;
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 10; i++) {
+				threads.emplace_back([] {
+					histogram::record(7);
+					histogram::record(1000, 2);
+				});
+			}
+		}
+
+		auto const s = histogram::read();
+		REQUIRE(s.count() == 30);
+		REQUIRE(s.buckets()[histogram::bucket_of(7)] == 10);
+		REQUIRE(s.buckets()[histogram::bucket_of(1000)] == 20);
+	}
+
+	SECTION("can be read while threads are recording and exiting") {
+		using histogram = tls::unique_histogram<>;
+		std::atomic_bool done = false;
+		bool monotonic = true;
+
+		std::jthread reader([&] {
+			std::uint64_t last = 0;
+			while (!done) {
+				std::uint64_t const current = histogram::read().count();
+				monotonic = monotonic && (current >= last);
+				last = current;
+			}
+		});
+
+		for (int round = 0; round < 10; round++) {
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < 4; i++)
+				threads.emplace_back([] {
+					for (std::uint64_t v = 0; v < 100; v++)
+						histogram::record(v);
+				});
+		}
+		done = true;
+		reader.join();
+
+		CHECK(monotonic);
+		REQUIRE(histogram::read().count() == 10 * 4 * 100);
+	}
+}
@@ -0,0 +1,307 @@
+#include "../catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <coroutine>
+#include <filesystem>
+#include <latch>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tls/replicate.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Returns the number of NUMA nodes, or the number of cpus if the nodes can't be counted
+static std::size_t numa_node_count() {
+#if defined(_WIN32)
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber(&highest))
+		return highest + 1;
+#elif defined(__linux__)
+	std::error_code ec;
+	std::size_t nodes = 0;
+	for (auto const& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+		std::string const name = entry.path().filename().string();
+		if (name.starts_with("node") && name.size() > 4 && std::all_of(name.begin() + 4, name.end(), ::isdigit))
+			nodes++;
+	}
+	if (nodes > 0)
+		return nodes;
+#endif
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// A coroutine that starts right away and is never awaited
+struct detached {
+	struct promise_type {
+		detached get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() { throw; }
+	};
+};
+
+TEST_CASE("tls::replicate<> specification") {
+	SECTION("readers see the initial data") {
+		tls::replicate<int, struct initial> repl{4};
+		REQUIRE(repl.read() == 4);
+		REQUIRE(repl.read([](int const& i) { return i * 2; }) == 8);
+	}
+
+	SECTION("writes bump the version") {
+		tls::replicate<int, struct version> repl{0};
+		auto const v = repl.version();
+		repl.write(1);
+		REQUIRE(repl.version() != v);
+	}
+
+	SECTION("readers see new writes") {
+		tls::replicate<std::string, struct writes> repl{"a"};
+		std::atomic_bool saw_update = false;
+
+		std::jthread reader([&] {
+			while (repl.read() != "b") {
+				std::this_thread::yield();
+			}
+			saw_update = true;
+		});
+
+		REQUIRE(repl.read() == "a");
+		repl.write(std::string{"b"});
+		reader.join();
+		REQUIRE(saw_update);
+		REQUIRE(repl.read() == "b");
+	}
+
+	SECTION("shared snapshots are not copied per thread") {
+		tls::replicate<std::vector<int>, struct shared, tls::shared_snapshot> repl{std::vector<int>(16, 1)};
+
+		std::vector<int> const* main_data = &repl.read();
+		std::vector<int> const* thread_data = nullptr;
+		std::jthread([&] { thread_data = &repl.read(); }).join();
+		REQUIRE(main_data == thread_data);
+		REQUIRE(main_data == &repl.base_data());
+
+		repl.write(std::vector<int>(4, 2));
+		REQUIRE(repl.read() == std::vector<int>(4, 2));
+	}
+
+	SECTION("modify changes the data in place") {
+		tls::replicate<std::vector<int>, struct modify> repl{std::vector<int>{1, 2}};
+		std::vector<int> const* master = &repl.base_data();
+		REQUIRE(repl.read() == std::vector<int>{1, 2});
+
+		repl.modify([](std::vector<int>& v) { v.push_back(3); });
+		REQUIRE(&repl.base_data() == master);
+		REQUIRE(repl.read() == std::vector<int>{1, 2, 3});
+
+		tls::replicate<std::vector<int>, struct modify_shared, tls::shared_snapshot> shared{std::vector<int>{1}};
+		shared.modify([](std::vector<int>& v) { v.push_back(2); });
+		REQUIRE(shared.read() == std::vector<int>{1, 2});
+	}
+
+	SECTION("batches publish one version") {
+		tls::replicate<int, struct batch> repl{0};
+		std::uint64_t const v = repl.version();
+		{
+			auto b = repl.batch_write();
+			for (int i = 0; i < 100; i++)
+				b.modify([](int& i) { i++; });
+			b.data() *= 2;
+
+			// Nothing is published until the batch ends
+			REQUIRE(repl.version() == v);
+		}
+		REQUIRE(repl.version() == v + 1);
+		REQUIRE(repl.read() == 200);
+	}
+
+	SECTION("concurrent modifications are not lost") {
+		tls::replicate<int, struct multi_writer> repl{0};
+		{
+			std::vector<std::jthread> writers;
+			for (int t = 0; t < 4; t++)
+				writers.emplace_back([&] {
+					for (int i = 0; i < 1000; i++)
+						repl.modify([](int& i) { i++; });
+				});
+		}
+		REQUIRE(repl.read() == 4000);
+	}
+
+	SECTION("readers can wait for new writes") {
+		tls::replicate<int, struct wait> repl{0};
+		std::uint64_t const v = repl.version();
+
+		int value = 0;
+		std::jthread reader([&] {
+			repl.wait_for_update(v);
+			value = repl.read();
+		});
+
+		repl.write(1);
+		reader.join();
+		REQUIRE(value == 1);
+		REQUIRE(repl.wait_for_update(v) == repl.version());
+	}
+
+	SECTION("timed waits give up") {
+		using namespace std::chrono_literals;
+		tls::replicate<int, struct timed_wait> repl{0};
+		auto const& const_repl = repl;
+		std::uint64_t const v = repl.version();
+		REQUIRE(const_repl.wait_for_update(v, 1ms) == v);
+
+		repl.write(1);
+		REQUIRE(const_repl.wait_for_update(v, 1ms) != v);
+	}
+
+	SECTION("coroutines are resumed by writes") {
+		tls::replicate<int, struct awaited> repl{0};
+
+		int value = 0;
+		auto const coro = [&](std::uint64_t last_version) -> detached {
+			co_await repl.updated(last_version);
+			value = repl.read();
+		};
+		coro(repl.version());
+		REQUIRE(value == 0);
+
+		repl.write(2);
+		REQUIRE(value == 2);
+
+		// Does not suspend if the version is already different
+		coro(repl.version() - 1);
+		REQUIRE(value == 2);
+		repl.write(3);
+		REQUIRE(value == 2);
+	}
+
+	SECTION("per-node snapshots are shared by the threads on a node") {
+		tls::replicate<std::vector<int>, struct per_node, tls::per_node_snapshot> repl{std::vector<int>(16, 1)};
+		REQUIRE(repl.read() == std::vector<int>(16, 1));
+
+		// All threads see the same data, and it is only copied once per node. The threads are
+		// kept alive until all of them have read it, so a copy can't be freed and its address reused.
+		std::vector<std::vector<int> const*> seen(8);
+		std::atomic_int mismatches = 0;
+		{
+			std::latch all_read(std::ssize(seen));
+			std::vector<std::jthread> threads;
+			for (auto& address : seen)
+				threads.emplace_back([&repl, &address, &all_read, &mismatches] {
+					address = &repl.read();
+					if (*address != std::vector<int>(16, 1))
+						mismatches++;
+					all_read.arrive_and_wait();
+				});
+		}
+		seen.push_back(&repl.read());
+		REQUIRE(mismatches == 0);
+		REQUIRE(std::set(seen.begin(), seen.end()).size() <= numa_node_count());
+
+		repl.write(std::vector<int>(4, 2));
+		REQUIRE(repl.read() == std::vector<int>(4, 2));
+		std::vector<int> thread_data;
+		std::jthread([&] { thread_data = repl.read(); }).join();
+		REQUIRE(thread_data == std::vector<int>(4, 2));
+	}
+
+	SECTION("readers apply the patches they missed") {
+		// Counts how many times patches are applied
+		struct set_entry {
+			int* applied;
+			std::size_t index;
+			int value;
+			void operator()(std::vector<int>& v) const {
+				++*applied;
+				v[index] = value;
+			}
+		};
+
+		int applied = 0;
+		tls::replicate<std::vector<int>, struct deltas, tls::patch_log<set_entry, 4>> repl{std::vector<int>(8, 0)};
+		REQUIRE(repl.read() == std::vector<int>(8, 0));
+
+		// The writer applies the patches, then the reader applies them to its copy
+		repl.write_delta({&applied, 1, 1});
+		repl.write_delta({&applied, 2, 2});
+		REQUIRE(applied == 2);
+		REQUIRE(repl.read() == std::vector<int>{0, 1, 2, 0, 0, 0, 0, 0});
+		REQUIRE(applied == 4);
+
+		// The reader missed more patches than the log holds, so it copies the data
+		for (int i = 0; i < 5; i++)
+			repl.write_delta({&applied, 3, i});
+		REQUIRE(applied == 9);
+		REQUIRE(repl.read() == std::vector<int>{0, 1, 2, 4, 0, 0, 0, 0});
+		REQUIRE(applied == 9);
+
+		// A full write discards the log
+		repl.write(std::vector<int>(2, 7));
+		REQUIRE(repl.read() == std::vector<int>(2, 7));
+		REQUIRE(applied == 9);
+
+		repl.write_delta({&applied, 0, 5});
+		REQUIRE(repl.read() == std::vector<int>{5, 7});
+		REQUIRE(applied == 11);
+
+		// So does modify
+		repl.modify([](std::vector<int>& v) { v[1] = 8; });
+		REQUIRE(repl.read() == std::vector<int>{5, 8});
+		REQUIRE(applied == 11);
+	}
+
+	SECTION("instances are independent") {
+		using repl_t = tls::replicate<int>;
+		repl_t a{1};
+		repl_t b{2};
+		REQUIRE(a.read() == 1);
+		REQUIRE(b.read() == 2);
+
+		std::uint64_t const version_b = b.version();
+		a.write(3);
+		REQUIRE(b.version() == version_b);
+		REQUIRE(a.read() == 3);
+		REQUIRE(b.read() == 2);
+
+		int thread_a = 0, thread_b = 0;
+		std::jthread([&] {
+			thread_a = a.read();
+			thread_b = b.read();
+		}).join();
+		REQUIRE(thread_a == 3);
+		REQUIRE(thread_b == 2);
+	}
+
+	SECTION("instances can be destroyed while their readers are alive") {
+		std::atomic_bool done = false;
+		std::atomic_int num_read = 0;
+		std::vector<std::jthread> readers;
+
+		auto repl = std::make_unique<tls::replicate<std::string>>(std::string{"x"});
+		for (int i = 0; i < 4; i++) {
+			readers.emplace_back([&] {
+				(void)repl->read();
+				num_read++;
+				while (!done)
+					std::this_thread::yield();
+			});
+		}
+		while (num_read != 4)
+			std::this_thread::yield();
+
+		// A new instance can reuse the old instances index
+		repl.reset();
+		tls::replicate<std::string> other{std::string{"y"}};
+		REQUIRE(other.read() == "y");
+
+		done = true;
+	}
+}